@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../spitft.h"
+
+// Full-frame throughput benchmark, run the same frames through either the kernel driver
+// (/dev/tftchar, GIF_MODE row protocol) or the userspace spidev backend of the same
+// protocol core, to compare the cost of the kernel/userspace transitions. Built by
+// `make bench`, which needs libgpiod 1.x
+
+enum BACKEND_TYPE {
+    KERNEL = 1,
+    SPIDEV
+};
+
+volatile sig_atomic_t _exitflag = 0;  // SIGINT/SIGTERM
+
+void exitSigHandler(int sig) {
+    if (sig == SIGINT || sig == SIGTERM) _exitflag = 1;
+}
+
+uint64_t NanoTime(void) {
+    struct timespec res;
+    clock_gettime(CLOCK_MONOTONIC, &res);
+    return 1000000000ULL*res.tv_sec + res.tv_nsec;
+}
+
+// Vertical RGB-565 (MSB-first) color bars, shifted by iframe so every frame differs
+void fillFrame(uint8_t *frame, int width, int height, int iframe) {
+    static const uint16_t bars[] = { 0xF800, 0x07E0, 0x001F, 0xFFE0, 0x07FF, 0xF81F, 0xFFFF, 0x0000 };
+    const int nbars = sizeof(bars)/sizeof(bars[0]);
+    for (int y=0; y<height; ++y) {
+        for (int x=0; x<width; ++x) {
+            uint16_t color = bars[((x + iframe) * nbars / width) % nbars];
+            *frame++ = (uint8_t)(color >> 8);
+            *frame++ = (uint8_t)(color & 0xFF);
+        }
+    }
+}
+
+// Kernel path: one write per row, the driver flushes the frame on its last row
+bool kernelFrame(int devfd, const uint8_t *frame, int width, int height) {
+    Rect window = { 0, 0, width, height };
+    if (write(devfd, (void *)&window, sizeof(Rect)) != sizeof(Rect)) {
+        printf("ERROR: [%s] in kernelFrame::write(Rect)\n", strerror(errno));
+        return false;
+    }
+
+    for (int y=0; y<height; ++y) {
+        if (write(devfd, (void *)&frame[y*width*2], width*2) != width*2) {
+            printf("ERROR: [%s] in kernelFrame::write()\n", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Userspace path: the same CASET/PASET/RAMWR + pixel flush the driver does
+bool spidevFrame(ili9341_dev *spidev, const uint8_t *frame) {
+    set_addr_window(spidev, 0, 0, spidev->width, spidev->height);
+    send_command(spidev, ILI9341_RAMWR);
+    if (send_pixels(spidev, frame, spidev->width * spidev->height) != 0) {
+        printf("ERROR: in spidevFrame::send_pixels\n");
+        return false;
+    }
+    send_command(spidev, ILI9341_NOP);
+    return true;
+}
+
+void print_usage(void) {
+    printf("Usage: TftBench [-k | -u /dev/spidevX.Y] [-n frames] [-f hz] [-p panel] [-g gpiochip] [-c dc] [-e reset]\n");
+    printf("  -k Benchmark the kernel driver through /dev/tftchar (default)\n");
+    printf("  -u Benchmark the userspace backend on the given spidev node\n");
+    printf("  -n Number of frames (default 100)\n");
+    printf("  -f SPI clock for -u (Hz, default 16000000)\n");
+    printf("  -p Panel for -u: ILI9341, ST7789V or ILI9488 (default ILI9341)\n");
+    printf("  -g GPIO chip for -u (default gpiochip0)\n");
+    printf("  -c D/C GPIO line for -u (default 5)\n");
+    printf("  -e RESET GPIO line for -u (default 6)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int backend = KERNEL;
+    const char *spipath = NULL, *gpiochip = "gpiochip0", *panelname = "ILI9341";
+    unsigned int dc = 5, reset = 6;
+    uint32_t speed_hz = 16000000;
+    int opt, nframes = 100, iframe = 0;
+    int width, height, devfd = -1;
+    uint8_t write_mode = GIF_MODE;
+    uint64_t elapsed;
+    uint8_t *frame = NULL;
+    ili9341_dev spidev;
+    int ret = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "ku:n:f:p:g:c:e:")) != -1) {
+        switch (opt) {
+        case 'k': backend = KERNEL; break;
+        case 'u': backend = SPIDEV; spipath = optarg; break;
+        case 'n': nframes = atoi(optarg); break;
+        case 'f': speed_hz = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 'p': panelname = optarg; break;
+        case 'g': gpiochip = optarg; break;
+        case 'c': dc = (unsigned int)atoi(optarg); break;
+        case 'e': reset = (unsigned int)atoi(optarg); break;
+        default:
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    signal(SIGINT, exitSigHandler);
+    signal(SIGTERM, exitSigHandler);
+
+    if (backend == KERNEL) {
+        const char *devname = "/dev/tftchar";
+        Rect geometry;
+        if ((devfd = open(devname, O_RDWR)) == -1) {
+            printf("ERROR: [%s] in main::open(%s)\n", strerror(errno), devname);
+            exit(EXIT_FAILURE);
+        }
+        if (ioctl(devfd, SPITFT_IOCWRMODE, &write_mode) == -1 || ioctl(devfd, SPITFT_IOCGGEOMETRY, &geometry) == -1) {
+            printf("ERROR: [%s] in main::ioctl\n", strerror(errno));
+            close(devfd);
+            exit(EXIT_FAILURE);
+        }
+        width = geometry.w;
+        height = geometry.h;
+    }
+    else {
+        const panel_desc *panel = find_panel(panelname);
+        if (panel == NULL) {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+        if (spitft_open(&spidev, spipath, gpiochip, dc, reset, speed_hz, panel) != 0)
+            exit(EXIT_FAILURE);
+
+        init_tft_display(&spidev);
+        width = spidev.width;
+        height = spidev.height;
+        printf("%s on %s at %u Hz, %u byte SPI messages\n", panel->name, spipath, spidev.speed_hz, spidev.bufsiz);
+    }
+
+    frame = (uint8_t *)malloc(width * height * 2);
+    elapsed = 0;
+    for (iframe=0; iframe<nframes && !_exitflag; ++iframe) {
+        fillFrame(frame, width, height, iframe);
+
+        uint64_t start = NanoTime();
+        if (!(backend == KERNEL ? kernelFrame(devfd, frame, width, height) : spidevFrame(&spidev, frame))) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+        elapsed += NanoTime() - start;
+    }
+
+    if (iframe > 0 && elapsed > 0) {
+        double secs = elapsed / 1e9;
+        printf("%s: %d frames (%dx%d) in %.3f s, %.2f fps, %.2f MB/s\n", backend == KERNEL ? "kernel" : "spidev",
+            iframe, width, height, secs, iframe / secs, iframe * (width * height * 2.0) / secs / 1e6);
+    }
+
+    free((void *)frame);
+    if (backend == KERNEL) close(devfd);
+    else spitft_close(&spidev);
+    return ret;
+}
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -22,6 +24,9 @@ GIFIMAGE gif;
 uint8_t *pStart;
 int iFrame, iRow;
 int devfd;
+int tftWidth = ILI9341_TFTWIDTH, tftHeight = ILI9341_TFTHEIGHT;
+int nPresented;
+int64_t lateNsSum;
 
 // Global signal handler flags
 volatile sig_atomic_t _exitflag = 0;  // SIGINT/SIGTERM
@@ -39,6 +44,12 @@ struct timespec res;
     return iTime;
 } /* MilliTime() */
 
+uint64_t NanoTime(void) {
+    struct timespec res;
+    clock_gettime(CLOCK_MONOTONIC, &res);
+    return 1000000000ULL*res.tv_sec + res.tv_nsec;
+}
+
 
 void GIFDraw(GIFDRAW *pDraw) {
     ssize_t nwritten;
@@ -69,8 +80,32 @@ void GIFDrawStd(GIFDRAW *pDraw) {
     iRow += 1;
 }
 
+// Queue the decoded frame to show at *target, then advance *target by the GIF's frame delay
+bool presentFrame(uint64_t *target, int delayMs) {
+    PresentRequest request;
+    PresentFeedback feedback;
+
+    // Lead the first frame a little so the driver's queue can fill
+    if (*target == 0) *target = NanoTime() + 100000000ULL;
+
+    request.target_ns = *target;
+    request.id = iFrame;
+    if (ioctl(devfd, SPITFT_IOCPRESENT, &request) == -1) {
+        printf("ERROR: [%s] in presentFrame::ioctl(SPITFT_IOCPRESENT)\n", strerror(errno));
+        return false;
+    }
+    *target += (uint64_t)(delayMs > 0 ? delayMs : 10) * 1000000ULL;
+
+    // Collect feedback for frames already presented (EAGAIN once drained)
+    while (ioctl(devfd, SPITFT_IOCPRESENTFB, &feedback) == 0) {
+        lateNsSum += (int64_t)(feedback.present_ns - feedback.target_ns);
+        nPresented += 1;
+    }
+    return true;
+}
+
 bool readTest(void) {
-    size_t count = ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT * 2;
+    size_t count = tftWidth * tftHeight * 2;
     uint8_t *buffer = (uint8_t *)malloc(count);
     ssize_t nread = read(devfd, (void *)buffer, count);
     if(nread == -1) {
@@ -82,9 +117,9 @@ bool readTest(void) {
         printf("WARNING: only received %zi bytes in readTest::read()\n", nread);
     }
     
-    printf("Metrics 0: 0, 0, %i, %i\n", ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT);
+    printf("Metrics 0: 0, 0, %i, %i\n", tftWidth, tftHeight);
     for (int i=0; i<nread; ++i) {
-        if ((i+1) % (ILI9341_TFTWIDTH*2))
+        if ((i+1) % (tftWidth*2))
             printf("0x%02X,", buffer[i]);
         else printf("0x%02X\n", buffer[i]);
     }
@@ -102,52 +137,124 @@ bool rectTest(void) {
     return true;
 }
 
+// Loop a raw clip (back-to-back full frames of MSB-first RGB-565) with sendfile, so
+// the file's page cache pages go to the driver without passing through userspace
+bool rawPlay(const char *path) {
+    size_t framebytes = tftWidth * tftHeight * 2;
+    struct stat st;
+    off_t offset;
+    int iTime, fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        printf("ERROR: [%s] in rawPlay::open(%s)\n", strerror(errno), path);
+        if (fd != -1) close(fd);
+        return false;
+    }
+    if (st.st_size < framebytes) {
+        printf("ERROR: %s holds less than one %ix%i frame\n", path, tftWidth, tftHeight);
+        close(fd);
+        return false;
+    }
+
+    // Whole frames only, a trailing partial frame would shift every following loop
+    st.st_size -= st.st_size % framebytes;
+    while (!_exitflag) {
+        iTime = MilliTime();
+        for (offset = 0; !_exitflag && offset < st.st_size; ) {
+            if (sendfile(devfd, fd, &offset, st.st_size - offset) == -1) {
+                printf("ERROR: [%s] in rawPlay::sendfile()\n", strerror(errno));
+                close(fd);
+                return false;
+            }
+        }
+        iTime = MilliTime() - iTime;
+        printf("%d frames in %d ms\n", (int)(offset / framebytes), iTime);
+    }
+
+    close(fd);
+    return true;
+}
+
 void print_usage(void) {
-    printf("Usage: TftGifStreamer  [-t | -r] [-s] [-d number] <path/to/gif>\n");
+    printf("Usage: TftGifStreamer  [-t | -r | -l | -p | -v] [-s] [-d number] [-o degrees] <path/to/gif|raw>\n");
     printf("  -t Run random rectangle draw test\n");
     printf("  -r Run read display test\n");
+    printf("  -l Stream GIF rows to the display as they decode (low latency)\n");
+    printf("  -p Present frames on the GIF's own frame delays (driver paced)\n");
+    printf("  -v Play a raw RGB-565 (big endian) full-frame clip via sendfile\n");
     printf("  -s Write to stdout (rather than /dev/tftchar) \n");
     printf("  -d Set write delay b/w frames (sec)\n");
+    printf("  -o Set panel rotation (0, 90, 180 or 270 degrees)\n");
 }
 
 int main(int argc, char *argv[]) {
     int iTime, opt;
-    int w, h;
+    int w, h, delayMs;
+    uint64_t target = 0;
     int status = 1;
     int touput = CDEVICE;
     uint32_t delay = 0;
     uint8_t write_mode = GIF_MODE;
+    int rotation = -1;
     int ret = EXIT_SUCCESS;
 
-    while ((opt = getopt(argc, argv, "strd:")) != -1) {
+    while ((opt = getopt(argc, argv, "strlpvd:o:")) != -1) {
         switch (opt) {
         case 's':
             touput = STDOUT;
             break;
         case 't':
-            if (write_mode == NOP_MODE) {
+            if (write_mode != GIF_MODE && write_mode != RECT_MODE) {
                 print_usage();
                 exit(EXIT_FAILURE);
             }
             write_mode = RECT_MODE;
             break;
         case 'r':
-            if (write_mode == RECT_MODE) {
+            if (write_mode != GIF_MODE && write_mode != NOP_MODE) {
                 print_usage();
                 exit(EXIT_FAILURE);
             }
             write_mode = NOP_MODE;
             break;
+        case 'l':
+            if (write_mode != GIF_MODE && write_mode != STREAM_MODE) {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+            write_mode = STREAM_MODE;
+            break;
+        case 'p':
+            if (write_mode != GIF_MODE && write_mode != PRESENT_MODE) {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+            write_mode = PRESENT_MODE;
+            break;
+        case 'v':
+            if (write_mode != GIF_MODE && write_mode != RAW_MODE) {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+            write_mode = RAW_MODE;
+            break;
         case 'd':
             delay = atoi(optarg); // optarg holds the argument for -d
             break;
+        case 'o':
+            rotation = atoi(optarg);
+            if (rotation % 90 != 0 || rotation < 0 || rotation > 270) {
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+            break;
         default: // Handles unknown options or missing arguments
             print_usage();
             exit(EXIT_FAILURE);
         }
     }
 
-    if (write_mode == GIF_MODE && optind >= argc) {
+    if ((write_mode >= GIF_MODE && optind >= argc) || (write_mode == RAW_MODE && touput == STDOUT)) {
         print_usage();
         exit(EXIT_FAILURE);
     }
@@ -164,6 +271,24 @@ int main(int argc, char *argv[]) {
             ret = EXIT_FAILURE;
             goto close_out;
         }
+
+        if (rotation != -1) {
+            uint8_t rotate = (uint8_t)(rotation / 90);
+            if(ioctl(devfd, SPITFT_IOCSROTATE, &rotate) == -1) {
+                printf("ERROR: [%s] in main::ioctl(SPITFT_IOCSROTATE)\n", strerror(errno));
+                ret = EXIT_FAILURE;
+                goto close_out;
+            }
+        }
+
+        Rect geometry;
+        if(ioctl(devfd, SPITFT_IOCGGEOMETRY, &geometry) == -1) {
+            printf("ERROR: [%s] in main::ioctl(SPITFT_IOCGGEOMETRY)\n", strerror(errno));
+            ret = EXIT_FAILURE;
+            goto close_out;
+        }
+        tftWidth = geometry.w;
+        tftHeight = geometry.h;
     }
 
     if (write_mode == NOP_MODE) {
@@ -181,7 +306,13 @@ int main(int argc, char *argv[]) {
             sleep(delay > 0 ? delay : 1);
         }
     }
-    else if (write_mode == GIF_MODE) {
+    else if (write_mode == RAW_MODE) {
+        if (!rawPlay(argv[optind])) {
+            ret = EXIT_FAILURE;
+            goto close_out;
+        }
+    }
+    else if (write_mode >= GIF_MODE) {
         memset(&gif, 0, sizeof(gif));
         GIF_begin(&gif, GIF_PALETTE_RGB565_BE);
         if (GIF_openFile(&gif, argv[optind], touput == STDOUT ? GIFDrawStd : GIFDraw)) {
@@ -191,14 +322,19 @@ int main(int argc, char *argv[]) {
             pStart = &gif.pFrameBuffer[w*h];
             gif.ucDrawType = GIF_DRAW_COOKED;
             while (!_exitflag) {
-                iFrame = iRow = 0;
+                iFrame = iRow = nPresented = 0;
+                lateNsSum = 0;
                 iTime = MilliTime();
                 while (!_exitflag && status > 0) {
-                    if ((status = GIF_playFrame(&gif, NULL, NULL)) == -1) {
+                    if ((status = GIF_playFrame(&gif, &delayMs, NULL)) == -1) {
                         printf("ERROR: [%i], in main::GIF_playFrame\n", gif.iError);
                         ret = EXIT_FAILURE;
                         goto close_out;
                     }
+                    if (write_mode == PRESENT_MODE && touput == CDEVICE && !presentFrame(&target, delayMs)) {
+                        ret = EXIT_FAILURE;
+                        goto close_out;
+                    }
                     iFrame += 1;
                     iRow = 0;
 
@@ -206,6 +342,8 @@ int main(int argc, char *argv[]) {
                 }
                 iTime = MilliTime() - iTime;
                 printf("%d frames in %d ms\n", iFrame, iTime);
+                if (nPresented > 0)
+                    printf("%d frames presented, avg %lld us late\n", nPresented, (long long)(lateNsSum / nPresented / 1000));
                 GIF_reset(&gif);
                 status = 1;
             }
@@ -4,6 +4,7 @@
 #ifdef __KERNEL__
 #include <linux/types.h>
 #else
+#include <stddef.h>
 #include <stdint.h>
 #endif
 
@@ -19,6 +20,21 @@
 #define NOP_MODE  0x00
 #define RECT_MODE 0x01
 #define GIF_MODE 0x02
+#define STREAM_MODE 0x03 // Same Rect + rows protocol as GIF_MODE, rows go to the TFT as written
+#define PRESENT_MODE 0x04 // Same protocol as GIF_MODE, frames are shown via SPITFT_IOCPRESENT
+#define RAW_MODE 0x05 // Back-to-back full frames, no Rect headers, also accepts splice/sendfile
+
+// writev/io_uring segments count as separate writes in every mode, splice/sendfile
+// into /dev/tftchar is only accepted in RAW_MODE (EINVAL otherwise)
+
+// Rotation values for SPITFT_IOCSROTATE, optionally OR'd with mirror flags
+#define ROTATE_0   0x00
+#define ROTATE_90  0x01
+#define ROTATE_180 0x02
+#define ROTATE_270 0x03
+#define ROTATE_MASK 0x03
+#define MIRROR_X 0x04
+#define MIRROR_Y 0x08
 
 #define LOW 0
 #define HIGH 1
@@ -39,16 +55,68 @@ typedef struct {
     int x, y, w, h; // position and size (px)
 } Rect;
 
+// Sprite cache draw targets
+#define SPRITE_FRAMEBUF 0x00 // Blit into frame_buffer only, shown with the next frame
+#define SPRITE_PANEL 0x01    // Blit into frame_buffer and send that window to the TFT
+
+typedef struct {
+    uint16_t w, h;         // size (px)
+    const uint8_t *pixels; // w*h RGB-565 pixels, MSB-first (same as row writes)
+    int32_t handle;        // returned by the driver, > 0 on success
+} SpriteUpload;
+
+typedef struct {
+    int32_t handle;  // from SpriteUpload
+    int x, y;        // position (px), clipped to the panel
+    uint8_t target;  // SPRITE_FRAMEBUF or SPRITE_PANEL
+} SpriteDraw;
+
+typedef struct {
+    uint64_t target_ns; // CLOCK_MONOTONIC time the frame should be on the TFT (0: asap), at most 10 s ahead
+    uint32_t id;        // client frame id, echoed in PresentFeedback
+} PresentRequest;
+
+typedef struct {
+    uint32_t id;
+    uint64_t target_ns;
+    uint64_t start_ns;   // CLOCK_MONOTONIC time the flush started
+    uint64_t present_ns; // CLOCK_MONOTONIC time the last pixel was sent
+} PresentFeedback;
+
 // Arbitrary unused value from/based on https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define SPITFT_IOC_MAGIC 0x18
 
 // Define a write command from the user point of view, using command number 1
 #define SPITFT_IOCWRMODE _IOWR(SPITFT_IOC_MAGIC, 1, uint8_t)
 
+// Set panel rotation/mirroring (MADCTL), swaps logical width/height for 90/270
+#define SPITFT_IOCSROTATE _IOW(SPITFT_IOC_MAGIC, 2, uint8_t)
+
+// Get the logical (rotated) panel geometry as { 0, 0, width, height }
+#define SPITFT_IOCGGEOMETRY _IOR(SPITFT_IOC_MAGIC, 8, Rect)
+
+// Enable (1) or disable (0) GIF_MODE frame diffing: completed frames are compared
+// with a shadow of the TFT contents and only the changed regions are sent
+#define SPITFT_IOCSDIFF _IOW(SPITFT_IOC_MAGIC, 9, uint8_t)
+
+// Sprite cache: upload RGB-565 pixels once, then draw by handle. Cached sprites
+// may be evicted (LRU) to make room, drawing an evicted handle fails with ENOENT
+#define SPITFT_IOCUPLOADSPRITE _IOWR(SPITFT_IOC_MAGIC, 3, SpriteUpload)
+#define SPITFT_IOCDRAWSPRITE _IOW(SPITFT_IOC_MAGIC, 4, SpriteDraw)
+#define SPITFT_IOCFREESPRITE _IOW(SPITFT_IOC_MAGIC, 5, int32_t)
+
+// Present queue (PRESENT_MODE): queue the current frame for a target time, blocks
+// while the queue is full (unless O_NONBLOCK). Frames present in submission order, fails
+// with EBUSY mid-window and EINVAL for targets over 10 s ahead. Feedback returns EAGAIN when empty
+#define SPITFT_IOCPRESENT _IOW(SPITFT_IOC_MAGIC, 6, PresentRequest)
+#define SPITFT_IOCPRESENTFB _IOR(SPITFT_IOC_MAGIC, 7, PresentFeedback)
+
 // The maximum number of commands supported, used for bounds checking
-#define SPITFT_IOC_MAXNR 1
+#define SPITFT_IOC_MAXNR 9
 
-#ifdef __KERNEL__
+// Panel protocol core, shared by the kernel module and userspace programs built with
+// SPITFT_CORE defined (linked against spitft_core.c and the spidev backend)
+#if defined(__KERNEL__) || defined(SPITFT_CORE)
 #define ILI9341_NOP 0x00     // No-op register
 #define ILI9341_SWRESET 0x01 // Software reset register
 #define ILI9341_RDDID 0x04   // Read display identification information
@@ -104,26 +172,88 @@ typedef struct {
 #define ILI9341_GMCTRP1 0xE0 // Positive Gamma Correction
 #define ILI9341_GMCTRN1 0xE1 // Negative Gamma Correction
 
+#define MADCTL_MY 0x80  // Row address order (bottom to top)
+#define MADCTL_MX 0x40  // Column address order (right to left)
+#define MADCTL_MV 0x20  // Row/column exchange
+#define MADCTL_ML 0x10  // Vertical refresh order
+#define MADCTL_BGR 0x08 // BGR color filter panel
+#define MADCTL_MH 0x04  // Horizontal refresh order
+
+#define PIXFMT_RGB565 0x55 // COLMOD 16 bits/pixel
+#define PIXFMT_RGB666 0x66 // COLMOD 18 bits/pixel (3 bytes over SPI)
+
+#define INIT_DELAY 0x80    // OR'd into an init script nargs: a delay (ms) byte follows the args
+#define INIT_END 0x00, 0x00
+
+// Pixels converted per transfer for panels whose wire format isn't RGB-565
+#define XFER_NPIXELS 4096
+
+typedef struct ili9341_dev ili9341_dev;
+
+// Per-panel geometry, init and pixel format. Frame buffers are always MSB-first RGB-565,
+// send_pixels/fill_line are bound to the panel's wire format when the table is built
 typedef struct {
+    const char *name;
+    uint16_t width, height;     // native (ROTATE_0) geometry
+    uint8_t bpp;                // RAMWR bytes per pixel
+    uint8_t read_bpp;           // RAMRD bytes per pixel (after one dummy byte)
+    uint32_t max_hz;            // max SPI write clock
+    const uint8_t *init_script; // see run_init_script
+    uint8_t madctl[4];          // MADCTL value per ROTATE_*
+    int (*send_pixels)(ili9341_dev *spidev, const uint8_t *pixels, uint32_t npixels);
+    void (*fill_line)(uint8_t *line, RGB color, size_t npixels);
+} panel_desc;
+
+struct ili9341_dev {
+#ifdef __KERNEL__
     struct spi_device *ili9341;
     struct gpio_desc *dc_pin, *reset_pin;
-} ili9341_dev;
+#else
+    int spi_fd;                            // /dev/spidevX.Y
+    struct gpiod_chip *gpio_chip;          // libgpiod (v1 API)
+    struct gpiod_line *dc_pin, *reset_pin;
+    uint32_t speed_hz, bufsiz;             // bufsiz: max bytes per SPI_IOC_MESSAGE
+#endif
+    const panel_desc *panel;
+    uint8_t *xfer_buf;      // pixel conversion buffer (XFER_NPIXELS * panel->bpp)
+    uint16_t width, height; // logical geometry (after rotation)
+    uint8_t rotation;       // ROTATE_* | MIRROR_* currently in MADCTL
+};
+
+extern const panel_desc ili9341_panel;
+extern const panel_desc st7789_panel;
+extern const panel_desc ili9488_panel;
 
 // Byte packing helper functions
 uint8_t *pack_MSB16(uint8_t *data, uint16_t val);
 uint8_t *pack_RGB16(uint8_t *data, RGB color);
+uint8_t *pack_RGB18(uint8_t *data, RGB color);
 void fill_line16(uint8_t *line, RGB color, size_t npixels);
+void fill_line18(uint8_t *line, RGB color, size_t npixels);
 
-// SPI interface API
+// SPI interface API (backend: spitft_kspi.c or spitft_spidev.c)
 int send_command(ili9341_dev *spidev, uint8_t cmdcode);
 int send_data(ili9341_dev *spidev, const uint8_t *data, uint32_t nbytes);
 int read_data(ili9341_dev *spidev, uint8_t *data, uint32_t nbytes);
+#ifdef __KERNEL__
 int send_transaction(ili9341_dev *spidev, struct spi_transfer trans[], uint32_t ntrans);
+#else
+int spitft_open(ili9341_dev *spidev, const char *spipath, const char *gpiochip,
+    unsigned int dc, unsigned int reset, uint32_t speed_hz, const panel_desc *panel);
+void spitft_close(ili9341_dev *spidev);
+#endif
+
+// SPI interface API (core: spitft_core.c)
+int send_pixels(ili9341_dev *spidev, const uint8_t *pixels, uint32_t npixels);
 int draw_rect(ili9341_dev *spidev, Rect rect, RGB color);
 
-// ILI9341 specific commands
+// Panel commands (MIPI DCS compatible controllers)
+const panel_desc *find_panel(const char *name);
+int set_panel(ili9341_dev *spidev, const panel_desc *panel);
+void run_init_script(ili9341_dev *spidev, const uint8_t *script);
 void init_tft_display(ili9341_dev *spidev);
+int set_rotation(ili9341_dev *spidev, uint8_t rotation);
 int set_addr_window(ili9341_dev *spidev, uint16_t x1, uint16_t y1, uint16_t w, uint16_t h);
-#endif // __KERNEL__
+#endif // __KERNEL__ || SPITFT_CORE
 
 #endif // ILI9341_SPITFT_H
@@ -0,0 +1,320 @@
+// Panel protocol core: packing, init scripts, addressing and pixel transfer built on the
+// send_command/send_data/read_data backend (spitft_kspi.c in the kernel module, or
+// spitft_spidev.c for userspace programs over /dev/spidevX.Y)
+#include "spitft_port.h"
+#include "spitft.h"
+
+
+// Packs a uint16_t in MSB-first format
+uint8_t *pack_MSB16(uint8_t *data, uint16_t val) {
+    *data = (uint8_t)(val >> 8); data++;
+    *data = (uint8_t)(val & 0xFF); data++;
+    return data;
+}
+
+// Packs in 16-bit RGB-565 format
+uint8_t *pack_RGB16(uint8_t *data, RGB color) {
+    *data = (color.R << 3) | (color.G >> 5); data++;
+    *data = ((color.G & 0x7) << 5) | (color.B & 0x1F); data++;
+    return data;
+}
+
+// Packs in 18-bit RGB-666 format (one byte per channel, low 2 bits ignored)
+uint8_t *pack_RGB18(uint8_t *data, RGB color) {
+    *data = color.R & 0xFC; data++;
+    *data = color.G & 0xFC; data++;
+    *data = color.B & 0xFC; data++;
+    return data;
+}
+
+// Packs a length npixels data buffer of color in RGB-565 format
+void fill_line16(uint8_t *line, RGB color, size_t npixels) {
+    for (int i=0; i<npixels; i++) 
+        line = pack_RGB16(line, color);
+}
+
+// Packs a length npixels data buffer of color in RGB-666 format
+void fill_line18(uint8_t *line, RGB color, size_t npixels) {
+    for (int i=0; i<npixels; i++) 
+        line = pack_RGB18(line, color);
+}
+
+// Expands one MSB-first RGB-565 pixel to RGB-666
+static inline uint8_t *pack_565to666(uint8_t *data, const uint8_t *src) {
+    *data = src[0] & 0xF8; data++;
+    *data = ((src[0] << 5) | (src[1] >> 3)) & 0xFC; data++;
+    *data = src[1] << 3; data++;
+    return data;
+}
+
+// RGB-565 panels take frame buffer pixels as-is
+static int send_pixels_rgb565(ili9341_dev *spidev, const uint8_t *pixels, uint32_t npixels) {
+    return send_data(spidev, pixels, npixels*2);
+}
+
+// RGB-666 panels get frame buffer pixels expanded through xfer_buf in XFER_NPIXELS chunks
+static int send_pixels_rgb666(ili9341_dev *spidev, const uint8_t *pixels, uint32_t npixels) {
+    uint32_t nchunk;
+    uint8_t *dst;
+    int err = 0;
+
+    while (npixels > 0 && err == 0) {
+        nchunk = npixels < XFER_NPIXELS ? npixels : XFER_NPIXELS;
+        dst = spidev->xfer_buf;
+        for (uint32_t i=0; i<nchunk; ++i, pixels += 2)
+            dst = pack_565to666(dst, pixels);
+
+        err = send_data(spidev, spidev->xfer_buf, nchunk*3);
+        npixels -= nchunk;
+    }
+    return err;
+}
+
+// Send npixels MSB-first RGB-565 pixels as RAMWR data in the panel's wire format
+int send_pixels(ili9341_dev *spidev, const uint8_t *pixels, uint32_t npixels) {
+    return spidev->panel->send_pixels(spidev, pixels, npixels);
+}
+EXPORT_SYMBOL(send_pixels);
+
+int draw_rect(ili9341_dev *spidev, Rect rect, RGB color) {
+    uint32_t nbytes = rect.w * spidev->panel->bpp;
+    uint8_t *line = (uint8_t *)kmalloc(nbytes, GFP_KERNEL);
+    if (line == NULL) {
+        printk(KERN_ERR "[ENOMEM] in draw_rect::kmalloc\n");
+        return -ENOMEM;
+    }
+
+    spidev->panel->fill_line(line, color, rect.w);
+    set_addr_window(spidev, rect.x, rect.y, rect.w, rect.h);
+
+    send_command(spidev, ILI9341_RAMWR);
+    for (uint32_t i=0; i<rect.h; ++i)
+        send_data(spidev, line, nbytes);
+    
+    // NOP to terminate RAMWR cmd
+    send_command(spidev, ILI9341_NOP);
+    kfree((void *)line);
+    return 0;
+}
+EXPORT_SYMBOL(draw_rect);
+
+// Run an init script of { cmd, nargs, args..., [delay ms if nargs & INIT_DELAY] } entries
+void run_init_script(ili9341_dev *spidev, const uint8_t *script) {
+    uint8_t cmd, nargs;
+
+    while (script[0] != 0x00 || script[1] != 0x00) { // INIT_END
+        cmd = *script++;
+        nargs = *script++;
+        send_command(spidev, cmd);
+        if (nargs & ~INIT_DELAY) 
+            send_data(spidev, script, nargs & ~INIT_DELAY);
+        script += nargs & ~INIT_DELAY;
+        if (nargs & INIT_DELAY)
+            mdelay(*script++);
+    }
+}
+EXPORT_SYMBOL(run_init_script);
+
+// Select the panel and allocate its transfer buffer (only needed if pixels are converted)
+int set_panel(ili9341_dev *spidev, const panel_desc *panel) {
+    kfree((void *)spidev->xfer_buf);
+    spidev->xfer_buf = NULL;
+    spidev->panel = panel;
+
+    if (panel->bpp != 2 && (spidev->xfer_buf = (uint8_t *)kmalloc(XFER_NPIXELS*panel->bpp, GFP_KERNEL)) == NULL) {
+        printk(KERN_ERR "[ENOMEM] in set_panel::kmalloc\n");
+        return -ENOMEM;
+    }
+
+    spidev->width = panel->width;
+    spidev->height = panel->height;
+    return 0;
+}
+EXPORT_SYMBOL(set_panel);
+
+
+// Initialization sequence adapted from https://github.com/adafruit/Adafruit_ILI9341, written by Limor Fried/Ladyada 
+// for Adafruit Industries, MIT license. Please see https://github.com/adafruit/Adafruit_ILI9341/blob/master/README.md
+static const uint8_t ili9341_init[] = {
+    0x01, INIT_DELAY, 150, // SW Reset (doesn't hurt but only really need if RESET pin is floating)
+    0xEF, 3, 0x03, 0x80, 0x02,
+    0xCF, 3, 0x00, 0xC1, 0x30,
+    0xED, 4, 0x64, 0x03, 0x12, 0x81,
+    0xE8, 3, 0x85, 0x00, 0x78,
+    0xCB, 5, 0x39, 0x2C, 0x00, 0x34, 0x02,
+    0xF7, 1, 0x20,
+    0xEA, 2, 0x00, 0x00,
+    0xC0, 1, 0x23,       // Power control VRH[5:0]
+    0xC1, 1, 0x10,       // Power control SAP[2:0];BT[3:0]
+    0xC5, 2, 0x3e, 0x28, // VCM control
+    0xC7, 1, 0x86,       // VCM control2
+    0x37, 1, 0x00,       // Vertical scroll zero
+    0x3A, 1, PIXFMT_RGB565,
+    0xB1, 2, 0x00, 0x18,
+    0xB6, 3, 0x08, 0x82, 0x27, // Display Function Control
+    0xF2, 1, 0x00,             // Gamma Function Disable
+    0x26, 1, 0x01,             // Gamma curve selected
+    0xE0, 15, 0x0F, 0x31, 0x2B, 0x0C, 0x0E, 0x08, 0x4E, 0xF1, 0x37, 0x07, 0x10, 0x03, 0x0E, 0x09, 0x00, // Set Gamma
+    0xE1, 15, 0x00, 0x0E, 0x14, 0x03, 0x11, 0x07, 0x31, 0xC1, 0x48, 0x08, 0x0F, 0x0C, 0x31, 0x36, 0x0F, // Set Gamma
+    0x11, INIT_DELAY, 150, // Exit Sleep
+    0x29, INIT_DELAY, 150, // Display on
+    INIT_END
+};
+
+// Sequence adapted from the generic_st7789 init of Adafruit_ST7789 (Adafruit-ST7735-Library),
+// see mainline drivers/gpu/drm/panel/panel-sitronix-st7789v.c for panel-tuned power/gamma
+static const uint8_t st7789_init[] = {
+    0x01, INIT_DELAY, 150, // SW Reset
+    0x11, INIT_DELAY, 120, // Exit Sleep
+    0x3A, 1 | INIT_DELAY, PIXFMT_RGB565, 10,
+    0x21, INIT_DELAY, 10,  // Display inversion on (IPS panels)
+    0x13, INIT_DELAY, 10,  // Normal display mode on
+    0x29, INIT_DELAY, 120, // Display on
+    INIT_END
+};
+
+// Sequence adapted from the common ILI9488 SPI module init (18-bit only over SPI)
+static const uint8_t ili9488_init[] = {
+    0x01, INIT_DELAY, 150, // SW Reset
+    0xE0, 15, 0x00, 0x03, 0x09, 0x08, 0x16, 0x0A, 0x3F, 0x78, 0x4C, 0x09, 0x0A, 0x08, 0x16, 0x1A, 0x0F, // Positive gamma
+    0xE1, 15, 0x00, 0x16, 0x19, 0x03, 0x0F, 0x05, 0x32, 0x45, 0x46, 0x04, 0x0E, 0x0D, 0x35, 0x37, 0x0F, // Negative gamma
+    0xC0, 2, 0x17, 0x15,       // Power control 1
+    0xC1, 1, 0x41,             // Power control 2
+    0xC5, 3, 0x00, 0x12, 0x80, // VCOM control
+    0x3A, 1, PIXFMT_RGB666,
+    0xB0, 1, 0x00,             // Interface mode control
+    0xB1, 1, 0xA0,             // Frame rate 60Hz
+    0xB4, 1, 0x02,             // 2-dot inversion
+    0xB6, 3, 0x02, 0x02, 0x3B, // Display Function Control
+    0xB7, 1, 0xC6,             // Entry mode set
+    0xF7, 4, 0xA9, 0x51, 0x2C, 0x82, // Adjust control 3
+    0x11, INIT_DELAY, 120,     // Exit Sleep
+    0x29, INIT_DELAY, 25,      // Display on
+    INIT_END
+};
+
+const panel_desc ili9341_panel = {
+    .name = "ILI9341",
+    .width = 240, .height = 320,
+    .bpp = 2, .read_bpp = 3,
+    .max_hz = 32000000, // datasheet 10 MHz write cycle, modules are reliable well above it
+    .init_script = ili9341_init,
+    .madctl = {
+        MADCTL_MX | MADCTL_BGR,                         // ROTATE_0
+        MADCTL_MV | MADCTL_BGR,                         // ROTATE_90
+        MADCTL_MY | MADCTL_BGR,                         // ROTATE_180
+        MADCTL_MX | MADCTL_MY | MADCTL_MV | MADCTL_BGR  // ROTATE_270
+    },
+    .send_pixels = send_pixels_rgb565,
+    .fill_line = fill_line16,
+};
+EXPORT_SYMBOL(ili9341_panel);
+
+const panel_desc st7789_panel = {
+    .name = "ST7789V",
+    .width = 240, .height = 320,
+    .bpp = 2, .read_bpp = 3,
+    .max_hz = 62500000, // 16 ns write cycle
+    .init_script = st7789_init,
+    .madctl = {
+        0,                                  // ROTATE_0
+        MADCTL_MX | MADCTL_MV,              // ROTATE_90
+        MADCTL_MX | MADCTL_MY,              // ROTATE_180
+        MADCTL_MY | MADCTL_MV               // ROTATE_270
+    },
+    .send_pixels = send_pixels_rgb565,
+    .fill_line = fill_line16,
+};
+EXPORT_SYMBOL(st7789_panel);
+
+const panel_desc ili9488_panel = {
+    .name = "ILI9488",
+    .width = 320, .height = 480,
+    .bpp = 3, .read_bpp = 3,
+    .max_hz = 20000000, // 50 ns write cycle
+    .init_script = ili9488_init,
+    .madctl = {
+        MADCTL_MX | MADCTL_BGR,                         // ROTATE_0
+        MADCTL_MV | MADCTL_BGR,                         // ROTATE_90
+        MADCTL_MY | MADCTL_BGR,                         // ROTATE_180
+        MADCTL_MX | MADCTL_MY | MADCTL_MV | MADCTL_BGR  // ROTATE_270
+    },
+    .send_pixels = send_pixels_rgb666,
+    .fill_line = fill_line18,
+};
+EXPORT_SYMBOL(ili9488_panel);
+
+// Look up a panel descriptor by name (e.g. "ILI9341"), NULL if unknown
+const panel_desc *find_panel(const char *name) {
+    static const panel_desc *panels[] = { &ili9341_panel, &st7789_panel, &ili9488_panel };
+    for (int i=0; i<sizeof(panels)/sizeof(panels[0]); ++i)
+        if (strcmp(panels[i]->name, name) == 0) return panels[i];
+    return NULL;
+}
+EXPORT_SYMBOL(find_panel);
+
+void init_tft_display(ili9341_dev *spidev) {
+    run_init_script(spidev, spidev->panel->init_script);
+    set_rotation(spidev, spidev->rotation); // Memory Access Control
+}
+EXPORT_SYMBOL(init_tft_display);
+
+// Program MADCTL so the panel scans in the requested orientation, this lets landscape
+// content be written as-is rather than transposed per pixel by the client
+int set_rotation(ili9341_dev *spidev, uint8_t rotation) {
+    const panel_desc *panel = spidev->panel;
+    uint8_t value;
+    int err;
+
+    if (rotation & ~(ROTATE_MASK | MIRROR_X | MIRROR_Y)) {
+        printk(KERN_ERR "[EINVAL %u] in set_rotation\n", rotation);
+        return -EINVAL;
+    }
+
+    // Mirrors are in logical (rotated) coords: with MV set, MX/MY address swapped axes
+    value = panel->madctl[rotation & ROTATE_MASK];
+    if (rotation & MIRROR_X) value ^= (rotation & ROTATE_90) ? MADCTL_MY : MADCTL_MX;
+    if (rotation & MIRROR_Y) value ^= (rotation & ROTATE_90) ? MADCTL_MX : MADCTL_MY;
+
+    send_command(spidev, ILI9341_MADCTL);
+    if ((err = send_data(spidev, &value, 1)) != 0)
+        return err;
+
+    spidev->rotation = rotation;
+    spidev->width = (rotation & ROTATE_90) ? panel->height : panel->width;
+    spidev->height = (rotation & ROTATE_90) ? panel->width : panel->height;
+    return 0;
+}
+EXPORT_SYMBOL(set_rotation);
+
+int set_addr_window(ili9341_dev *spidev, uint16_t x1, uint16_t y1, uint16_t w, uint16_t h) {
+    static uint16_t old_x1 = 0xffff, old_x2 = 0xffff;
+    static uint16_t old_y1 = 0xffff, old_y2 = 0xffff;
+    static uint8_t data[4];
+    uint16_t x2, y2;
+
+    x2 = (x1 + w - 1);
+    if (x1 != old_x1 || x2 != old_x2) {
+        uint8_t *dptr = data;
+        dptr = pack_MSB16(dptr, x1);
+        dptr = pack_MSB16(dptr, x2);
+        send_command(spidev, ILI9341_CASET);
+        send_data(spidev, data, 4);
+        old_x1 = x1;
+        old_x2 = x2;
+    }
+
+    y2 = (y1 + h - 1);
+    if (y1 != old_y1 || y2 != old_y2) {
+        uint8_t *dptr = data;
+        dptr = pack_MSB16(dptr, y1);
+        dptr = pack_MSB16(dptr, y2);
+        send_command(spidev, ILI9341_PASET);
+        send_data(spidev, data, 4);
+        old_y1 = y1;
+        old_y2 = y2;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL(set_addr_window);
@@ -0,0 +1,80 @@
+// Kernel SPI backend for the panel protocol core (spitft_core.c)
+#include <linux/gpio/consumer.h>
+#include <linux/module.h>
+#include <linux/printk.h>
+#include <linux/spi/spi.h>
+
+#include "spitft.h"
+
+MODULE_AUTHOR("AJ Donich");
+MODULE_LICENSE("GPL");
+
+// Send a 1-byte SPI command 
+int send_command(ili9341_dev *spidev, uint8_t cmdcode) {
+    int err;
+    struct spi_transfer cmdtrans = {
+        .tx_buf = (const void *)&cmdcode,
+        .len = sizeof(uint8_t)
+    };
+
+    struct spi_message cmdmsg;
+    spi_message_init(&cmdmsg);
+    spi_message_add_tail(&cmdtrans, &cmdmsg);
+
+    gpiod_set_value(spidev->dc_pin, LOW);
+    if ((err = spi_sync(spidev->ili9341, &cmdmsg)) != 0)
+        printk(KERN_ERR "[%i] in send_command::spi_sync\n", -err);
+    gpiod_set_value(spidev->dc_pin, HIGH);
+    return err;
+}
+EXPORT_SYMBOL(send_command);
+
+// Send a multi-byte SPI block (in a single spi_transfer object) 
+int send_data(ili9341_dev *spidev, const uint8_t *data, uint32_t nbytes) {
+    int err;
+    struct spi_transfer dtrans = {
+        .tx_buf = (const void *)data,
+        .len = nbytes
+    };
+
+    struct spi_message dmsg;
+    spi_message_init(&dmsg);
+    spi_message_add_tail(&dtrans, &dmsg);
+    
+    if ((err = spi_sync(spidev->ili9341, &dmsg)) != 0)
+        printk(KERN_ERR "[%i] in send_data::spi_sync\n", -err);
+    return err;
+}
+EXPORT_SYMBOL(send_data);
+
+// Read a multi-byte SPI block (in a single spi_transfer object) 
+int read_data(ili9341_dev *spidev, uint8_t *data, uint32_t nbytes) {
+    int err;
+    struct spi_transfer dtrans = {
+        .rx_buf = (void *)data,
+        .len = nbytes
+    };
+
+    struct spi_message dmsg;
+    spi_message_init(&dmsg);
+    spi_message_add_tail(&dtrans, &dmsg);
+    
+    if ((err = spi_sync(spidev->ili9341, &dmsg)) != 0)
+        printk(KERN_ERR "[%i] in read_data::spi_sync\n", -err);
+    return err;
+}
+EXPORT_SYMBOL(read_data);
+
+// Send SPI "transaction" block (multiple spi_transfer objects) 
+int send_transaction(ili9341_dev *spidev, struct spi_transfer trans[], uint32_t ntrans) {
+    int err;
+    struct spi_message dmsg;
+    spi_message_init(&dmsg);
+    for (int i=0; i<ntrans; i++)
+        spi_message_add_tail(&trans[i], &dmsg);
+
+    if ((err = spi_sync(spidev->ili9341, &dmsg)) != 0)
+        printk(KERN_ERR "[%i] in send_transaction::spi_sync\n", -err);
+    return err;
+}
+EXPORT_SYMBOL(send_transaction);
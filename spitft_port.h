@@ -0,0 +1,35 @@
+#ifndef SPITFT_PORT_H
+#define SPITFT_PORT_H
+
+// Kernel APIs used by the panel protocol core (spitft_core.c), mapped onto libc when the
+// core is built into a userspace program with the spidev backend (spitft_spidev.c)
+#ifdef __KERNEL__
+#include <linux/delay.h>
+#include <linux/module.h>
+#include <linux/printk.h>
+#include <linux/slab.h>
+#include <linux/spi/spi.h> // struct spi_transfer, in the send_transaction prototype
+#include <linux/string.h>
+#else
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef SPITFT_CORE
+#define SPITFT_CORE
+#endif
+
+#define GFP_KERNEL 0
+#define KERN_ERR ""
+#define KERN_WARNING ""
+
+#define kmalloc(size, flags) malloc(size)
+#define kfree(ptr) free(ptr)
+#define mdelay(ms) usleep((ms) * 1000)
+#define printk(fmt, args...) fprintf(stderr, fmt, ## args)
+#define EXPORT_SYMBOL(sym)
+#endif // __KERNEL__
+
+#endif // SPITFT_PORT_H
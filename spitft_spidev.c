@@ -0,0 +1,132 @@
+// Userspace backend for the panel protocol core (spitft_core.c): SPI through
+// /dev/spidevX.Y (SPI_IOC_MESSAGE) and the D/C and RESET lines through libgpiod. Written
+// against the libgpiod 1.x API (gpiod_chip_open_lookup, gpiod_line_*), which 2.x removed
+#include <fcntl.h>
+#include <gpiod.h>
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+
+#include "spitft_port.h"
+#include "spitft.h"
+
+// spidev rejects messages larger than its bufsiz module parameter (4096 by default),
+// raise it (e.g. spidev.bufsiz=65536) to batch more data per ioctl
+#define SPIDEV_BUFSIZ_PARAM "/sys/module/spidev/parameters/bufsiz"
+#define SPIDEV_DEFAULT_BUFSIZ 4096U
+
+// Max bytes per spi_ioc_transfer (controller DMA limit), and transfers per message
+#define SPIDEV_MAX_XFER 65535U
+#define SPIDEV_MAX_NXFER 16
+
+// Run tx/rx (either may be NULL) as SPI_IOC_MESSAGE batches: each ioctl carries up to
+// bufsiz bytes, split into SPIDEV_MAX_XFER sized transfers
+static int spidev_transfer(ili9341_dev *spidev, const uint8_t *tx, uint8_t *rx, uint32_t nbytes) {
+    struct spi_ioc_transfer xfers[SPIDEV_MAX_NXFER];
+    uint32_t len, nmsg;
+    int nxfer;
+
+    while (nbytes > 0) {
+        memset(xfers, 0, sizeof(xfers));
+        nmsg = nbytes < spidev->bufsiz ? nbytes : spidev->bufsiz;
+        for (nxfer=0; nmsg > 0 && nxfer < SPIDEV_MAX_NXFER; ++nxfer) {
+            len = nmsg < SPIDEV_MAX_XFER ? nmsg : SPIDEV_MAX_XFER;
+            xfers[nxfer].tx_buf = (unsigned long)tx;
+            xfers[nxfer].rx_buf = (unsigned long)rx;
+            xfers[nxfer].len = len;
+            xfers[nxfer].speed_hz = spidev->speed_hz;
+            xfers[nxfer].bits_per_word = 8;
+
+            if (tx) tx += len;
+            if (rx) rx += len;
+            nmsg -= len;
+            nbytes -= len;
+        }
+
+        if (ioctl(spidev->spi_fd, SPI_IOC_MESSAGE(nxfer), xfers) < 0) {
+            printk(KERN_ERR "[%s] in spidev_transfer::ioctl(SPI_IOC_MESSAGE)\n", strerror(errno));
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+// Send a 1-byte SPI command
+int send_command(ili9341_dev *spidev, uint8_t cmdcode) {
+    int err;
+    gpiod_line_set_value(spidev->dc_pin, LOW);
+    err = spidev_transfer(spidev, &cmdcode, NULL, 1);
+    gpiod_line_set_value(spidev->dc_pin, HIGH);
+    return err;
+}
+
+// Send a multi-byte SPI block
+int send_data(ili9341_dev *spidev, const uint8_t *data, uint32_t nbytes) {
+    return spidev_transfer(spidev, data, NULL, nbytes);
+}
+
+// Read a multi-byte SPI block
+int read_data(ili9341_dev *spidev, uint8_t *data, uint32_t nbytes) {
+    return spidev_transfer(spidev, NULL, data, nbytes);
+}
+
+static uint32_t spidev_bufsiz(void) {
+    unsigned int bufsiz = SPIDEV_DEFAULT_BUFSIZ;
+    FILE *param = fopen(SPIDEV_BUFSIZ_PARAM, "r");
+    if (param) {
+        if (fscanf(param, "%u", &bufsiz) != 1) bufsiz = SPIDEV_DEFAULT_BUFSIZ;
+        fclose(param);
+    }
+    return bufsiz;
+}
+
+// Userspace counterpart of spi_tft_probe: open and configure spidev, claim D/C and RESET
+// (both driven HIGH) and select the panel. Call init_tft_display afterwards
+int spitft_open(ili9341_dev *spidev, const char *spipath, const char *gpiochip,
+    unsigned int dc, unsigned int reset, uint32_t speed_hz, const panel_desc *panel) {
+    uint8_t mode = SPI_MODE_0, bits = 8;
+    int err;
+
+    memset(spidev, 0, sizeof(ili9341_dev));
+    spidev->speed_hz = speed_hz < panel->max_hz ? speed_hz : panel->max_hz;
+    spidev->bufsiz = spidev_bufsiz();
+
+    if ((spidev->spi_fd = open(spipath, O_RDWR)) == -1) {
+        printk(KERN_ERR "[%s] in spitft_open::open(%s)\n", strerror(errno), spipath);
+        return -errno;
+    }
+
+    if (ioctl(spidev->spi_fd, SPI_IOC_WR_MODE, &mode) == -1 ||
+        ioctl(spidev->spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1 ||
+        ioctl(spidev->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &spidev->speed_hz) == -1) {
+        err = -errno;
+        printk(KERN_ERR "[%s] in spitft_open::ioctl(SPI_IOC_WR_*)\n", strerror(errno));
+        spitft_close(spidev);
+        return err;
+    }
+
+    if ((spidev->gpio_chip = gpiod_chip_open_lookup(gpiochip)) == NULL ||
+        (spidev->dc_pin = gpiod_chip_get_line(spidev->gpio_chip, dc)) == NULL ||
+        (spidev->reset_pin = gpiod_chip_get_line(spidev->gpio_chip, reset)) == NULL ||
+        gpiod_line_request_output(spidev->dc_pin, "spitft", HIGH) == -1 ||
+        gpiod_line_request_output(spidev->reset_pin, "spitft", HIGH) == -1) {
+        err = -errno;
+        printk(KERN_ERR "[%s] in spitft_open::gpiod(%s, %u, %u)\n", strerror(errno), gpiochip, dc, reset);
+        spitft_close(spidev);
+        return err;
+    }
+
+    if ((err = set_panel(spidev, panel)) != 0) {
+        spitft_close(spidev);
+        return err;
+    }
+    return 0;
+}
+
+void spitft_close(ili9341_dev *spidev) {
+    if (spidev->dc_pin) gpiod_line_release(spidev->dc_pin);
+    if (spidev->reset_pin) gpiod_line_release(spidev->reset_pin);
+    if (spidev->gpio_chip) gpiod_chip_close(spidev->gpio_chip);
+    if (spidev->spi_fd > 0) close(spidev->spi_fd);
+    kfree((void *)spidev->xfer_buf);
+    memset(spidev, 0, sizeof(ili9341_dev));
+}
@@ -1,17 +1,32 @@
 #include <linux/delay.h>
 #include <linux/fs.h>
 #include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
 #include <linux/init.h>
+#include <linux/kfifo.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/of.h>
+#include <linux/of_device.h>
 #include <linux/printk.h>
 #include <linux/random.h>
 #include <linux/spi/spi.h>
 #include <linux/string.h>
 #include <linux/sysinfo.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <uapi/linux/spi/spi.h>
 
+#ifdef SPI_TFT_V4L2
+#include <media/v4l2-device.h>
+#include <media/v4l2-ioctl.h>
+#include <media/videobuf2-v4l2.h>
+#include <media/videobuf2-vmalloc.h>
+#endif
+
 #include "spitft.h"
 
 MODULE_AUTHOR("AJ Donich");
@@ -31,14 +46,82 @@ MODULE_LICENSE("GPL");
 #define MIN(a,b) a <= b ? a : b 
 #define MAX(a,b) a >= b ? a : b 
 
+#define TFT_NPIXELS (tft_spidev.panel->width * tft_spidev.panel->height)
+
+#define SPRITE_NSLOTS 64
+#define DIFF_MAX_GAP 4 // clean rows bridged when merging dirty rows into one window
+#define PRESENT_DEPTH 3
+#define PRESENT_NFEEDBACK 16
+#define PRESENT_MAX_LEAD_NS (10ULL * NSEC_PER_SEC) // furthest target_ns accepted ahead of now
+
+typedef struct {
+    int32_t handle;     // 0 marks a free slot
+    uint16_t w, h;
+    uint64_t last_use;  // sprite_clock at last upload/draw, for LRU eviction
+    uint8_t *pixels;
+} Sprite;
+
+static unsigned int sprite_cache_kb = 256;
+module_param(sprite_cache_kb, uint, 0444);
+MODULE_PARM_DESC(sprite_cache_kb, "Memory limit of the sprite cache (KiB)");
+
+static bool stream_mirror = true;
+module_param(stream_mirror, bool, 0644);
+MODULE_PARM_DESC(stream_mirror, "Mirror STREAM_MODE rows into the frame buffer");
+
+static bool frame_diff = false;
+module_param(frame_diff, bool, 0444);
+MODULE_PARM_DESC(frame_diff, "Send only changed regions of GIF_MODE frames (see SPITFT_IOCSDIFF)");
 
-static ili9341_dev tft_spidev;
+
+static ili9341_dev tft_spidev = { .panel = &ili9341_panel };
 static struct cdev tft_cdev;
 
+// Serializes the SPI bus and frame_buffer between the cdev and V4L2 paths
+static DEFINE_MUTEX(tft_mutex);
+
 static uint8_t write_mode = GIF_MODE;
 static uint8_t *frame_buffer = NULL;
+static uint8_t *row_buffer = NULL;
 static Rect window = { 0,0,0,0 };
 static int yidx = -1;
+static size_t raw_pos = 0; // RAW_MODE bytes received of the current frame
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 0, 0)
+#define user_backed_iter(iter) iter_is_iovec(iter)
+#endif
+
+typedef struct {
+    uint16_t x0, x1; // changed pixel columns, x0 > x1 when the row is clean
+} DirtySpan;
+
+// Frame diffing (SPITFT_IOCSDIFF): shadow_buffer mirrors what the TFT shows, dirty_spans
+// has one entry per (logical) row. Both are NULL while diffing is disabled
+static uint8_t *shadow_buffer = NULL;
+static DirtySpan *dirty_spans = NULL;
+static bool shadow_valid = false;
+
+static Sprite sprite_cache[SPRITE_NSLOTS];
+static size_t sprite_bytes = 0;
+static int32_t sprite_handle = 0;
+static uint64_t sprite_clock = 0;
+
+typedef struct {
+    PresentRequest request;
+    uint8_t *pixels; // snapshot of frame_buffer at SPITFT_IOCPRESENT
+} PresentSlot;
+
+// Present queue ring (head is the next frame to flush), guarded by present_lock
+static PresentSlot present_queue[PRESENT_DEPTH];
+static int present_head = 0, present_count = 0;
+static DEFINE_SPINLOCK(present_lock);
+static DECLARE_WAIT_QUEUE_HEAD(present_wait);
+static DEFINE_KFIFO(present_feedback, PresentFeedback, PRESENT_NFEEDBACK);
+
+static struct hrtimer present_timer;
+static struct workqueue_struct *present_wq = NULL;
+static struct work_struct present_work;
+static uint64_t present_flush_ns = 0; // running estimate of a full-frame flush
 
 inline uint8_t rand8(void) {
     uint8_t value;
@@ -53,9 +136,16 @@ inline uint16_t rand16(void) {
 }
 
 static int spi_tft_probe(struct spi_device *spi) {
-    unsigned int maxfreq;
+    const panel_desc *panel;
+    unsigned int maxfreq, degrees;
     int err;
 
+    // Panel descriptor comes from the matched compatible string (of_tft_match)
+    if ((panel = (const panel_desc *)of_device_get_match_data(&spi->dev)) == NULL)
+        panel = &ili9341_panel;
+    if ((err = set_panel(&tft_spidev, panel)) != 0)
+        return err;
+
     maxfreq = spi->max_speed_hz;
     if ((err = of_property_read_u32(spi->dev.of_node, "spi-max-frequency", &maxfreq)) != 0)
         printk(KERN_WARNING "%i in spi_tft_probe::of_property_read_u32('spi-max-frequency')\n", err);
@@ -63,6 +153,8 @@ static int spi_tft_probe(struct spi_device *spi) {
     PDEBUG("spi_driver.probe() function: spi_tft_probe was called");
     PDEBUG("of_property_read_u32(spi-max-frequency): %u (max: %u)", maxfreq, spi->max_speed_hz);
     spi->max_speed_hz = MIN(spi->max_speed_hz, maxfreq);
+    spi->max_speed_hz = MIN(spi->max_speed_hz, panel->max_hz);
+    PDEBUG("panel %s: %ux%u, %u bytes/pixel, %u Hz", panel->name, panel->width, panel->height, panel->bpp, spi->max_speed_hz);
     spi->bits_per_word = 8;
     spi->mode = SPI_MODE_0;
     spi->rt = true;
@@ -76,6 +168,19 @@ static int spi_tft_probe(struct spi_device *spi) {
     tft_spidev.reset_pin = devm_gpiod_get(&spi->dev, "reset", GPIOD_OUT_HIGH);
     if (tft_spidev.reset_pin) PDEBUG("devm_gpiod_get(reset-gpio): GPIO%i", desc_to_gpio(tft_spidev.reset_pin));
 
+    // Optional "rotation" (degrees) and "mirror-x"/"mirror-y" properties, applied
+    // to MADCTL by init_tft_display
+    degrees = 0;
+    of_property_read_u32(spi->dev.of_node, "rotation", &degrees);
+    if (degrees % 90 != 0 || degrees > 270) {
+        printk(KERN_WARNING "[EINVAL %u] in spi_tft_probe::of_property_read_u32('rotation')\n", degrees);
+        degrees = 0;
+    }
+    tft_spidev.rotation = (uint8_t)(degrees / 90);
+    if (of_property_read_bool(spi->dev.of_node, "mirror-x")) tft_spidev.rotation |= MIRROR_X;
+    if (of_property_read_bool(spi->dev.of_node, "mirror-y")) tft_spidev.rotation |= MIRROR_Y;
+    PDEBUG("of_property_read_u32(rotation): %u (MADCTL flags: 0x%02X)", degrees, tft_spidev.rotation);
+
     tft_spidev.ili9341 = spi;
     return err;
 }
@@ -122,16 +227,25 @@ static ssize_t tft_read(struct file *filp, char __user *buf, size_t count, loff_
     int err, ncopy;
     uint8_t *data;
 
-    set_addr_window(&tft_spidev, 0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT);
-    send_command(&tft_spidev, ILI9341_RAMRD);
-
+    // RAMRD returns a dummy byte then read_bpp bytes per pixel
+    count = MIN(count, 1 + (size_t)TFT_NPIXELS * tft_spidev.panel->read_bpp);
     if ((data = (uint8_t *)kmalloc(count, GFP_KERNEL)) == NULL) {
         printk(KERN_ERR "[ENOMEM] in tft_read::kmalloc\n");
         return -ENOMEM;
     }
 
+    if (mutex_lock_interruptible(&tft_mutex)) {
+        kfree(data);
+        return -ERESTARTSYS;
+    }
+
+    set_addr_window(&tft_spidev, 0, 0, tft_spidev.width, tft_spidev.height);
+    send_command(&tft_spidev, ILI9341_RAMRD);
+    err = read_data(&tft_spidev, data, (uint32_t)count);
+    mutex_unlock(&tft_mutex);
+
     ncopy = 0;
-    if((err = read_data(&tft_spidev, data, (uint32_t)count)) == 0)
+    if (err == 0)
         ncopy = count - copy_to_user((void __user *)buf, (const void *)data, count);
 
     kfree(data);
@@ -139,15 +253,118 @@ static ssize_t tft_read(struct file *filp, char __user *buf, size_t count, loff_
     return (ssize_t)(err == 0 ? ncopy : err);
 }
 
+// Compared as remaining extents, rect.x + rect.w could overflow (and wrap) an int
+static bool window_valid(Rect rect) {
+    return rect.x >= 0 && rect.y >= 0 && rect.w > 0 && rect.h > 0 &&
+        rect.x < tft_spidev.width && rect.w <= tft_spidev.width - rect.x &&
+        rect.y < tft_spidev.height && rect.h <= tft_spidev.height - rect.y;
+}
+
+// Forward whole rows of the current window straight to the TFT (RAMWR is already
+// open on the window), optionally mirroring them into the frame_buffer
+static ssize_t stream_rows(const char __user *buf, size_t count) {
+    uint32_t stride = tft_spidev.width * 2, nbytes = window.w * 2;
+    uint32_t nrows = count / nbytes;
+    size_t fidx = ((size_t)(window.y + yidx)*tft_spidev.width + window.x)*2;
+    uint8_t *src;
+    int err;
+
+    if (count % nbytes != 0 || nrows == 0 || nrows > window.h - yidx) {
+        printk(KERN_ERR "[Bad row batch size: %zu] in stream_rows\n", count);
+        return -EINVAL;
+    }
+
+    // Full-width window rows are contiguous in frame_buffer, so mirror in place
+    src = (stream_mirror && window.w == tft_spidev.width) ? &frame_buffer[fidx] : row_buffer;
+    if (copy_from_user((void *)src, (const void __user *)buf, count) != 0) {
+        printk(KERN_ERR "[EFAULT] in stream_rows::copy_from_user\n");
+        return -EFAULT;
+    }
+
+    if (stream_mirror && src == row_buffer) {
+        for (uint32_t i=0; i<nrows; ++i)
+            memcpy((void *)&frame_buffer[fidx + i*stride], (const void *)&row_buffer[i*nbytes], nbytes);
+    }
+
+    if (shadow_buffer) {
+        for (uint32_t i=0; i<nrows; ++i)
+            memcpy((void *)&shadow_buffer[fidx + i*stride], (const void *)&src[i*nbytes], nbytes);
+    }
+
+    if ((err = send_pixels(&tft_spidev, src, count / 2)) != 0)
+        return err;
+
+    yidx += nrows;
+    if (yidx == window.h) {
+        // NOP to terminate RAMWR cmd
+        send_command(&tft_spidev, ILI9341_NOP);
+        yidx = -1;
+    }
+    return count;
+}
+
+// Byte offsets [*first, *last] bounding the differences of a and b, compared a long at a
+// time once aligned. Returns false if equal. a and b must share alignment (both kmalloc'd
+// frame-sized buffers at the same offset)
+static bool diff_bytes(const uint8_t *a, const uint8_t *b, uint32_t nbytes, uint32_t *first, uint32_t *last) {
+    const size_t wmask = sizeof(unsigned long) - 1;
+    uint32_t lo = 0, hi = nbytes;
+
+    while (lo < hi && ((uintptr_t)&a[lo] & wmask) && a[lo] == b[lo]) lo++;
+    if (((uintptr_t)&a[lo] & wmask) == 0) {
+        while (hi - lo >= sizeof(unsigned long) && 
+            *(const unsigned long *)&a[lo] == *(const unsigned long *)&b[lo]) lo += sizeof(unsigned long);
+    }
+    while (lo < hi && a[lo] == b[lo]) lo++;
+    if (lo == hi) return false;
+
+    while (hi > lo && ((uintptr_t)&a[hi] & wmask) && a[hi-1] == b[hi-1]) hi--;
+    if (((uintptr_t)&a[hi] & wmask) == 0) {
+        while (hi - lo >= sizeof(unsigned long) && 
+            *(const unsigned long *)&a[hi-sizeof(unsigned long)] == *(const unsigned long *)&b[hi-sizeof(unsigned long)]) 
+            hi -= sizeof(unsigned long);
+    }
+    while (hi > lo && a[hi-1] == b[hi-1]) hi--;
+
+    *first = lo;
+    *last = hi - 1;
+    return true;
+}
+
+// Widen row y's dirty span by the pixels of [x, x+w) that differ from the shadow
+static void diff_row(int y, int x, int w) {
+    uint32_t fidx = (y*tft_spidev.width + x)*2;
+    uint32_t first, last;
+    DirtySpan *span = &dirty_spans[y];
+
+    if (!diff_bytes(&frame_buffer[fidx], &shadow_buffer[fidx], w*2, &first, &last))
+        return;
+
+    span->x0 = MIN(span->x0, x + first/2);
+    span->x1 = MAX(span->x1, x + last/2);
+}
+
+static void reset_dirty_spans(void) {
+    uint16_t maxdim = MAX(tft_spidev.panel->width, tft_spidev.panel->height);
+    for (int y=0; y<maxdim; ++y) 
+        dirty_spans[y] = (DirtySpan){ 0xFFFF, 0 };
+}
+
+static int flush_dirty(void);
+static int raw_flush_frame(void);
+
 static ssize_t tft_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos) {
     static Rect rect = { 0,0,0,0 };
-    static int iframe = 0, fidx = 0;
+    static int iframe = 0;
+    size_t fidx;
 
-    size_t ncopy;
-    uint8_t *inbuffer;
+    ssize_t ncopy = count;
     uint8_t randval;
     RGB randcol;
 
+    if (mutex_lock_interruptible(&tft_mutex))
+        return -ERESTARTSYS;
+
     switch (write_mode) {
     case NOP_MODE: {
         PDEBUG("write_mode NOP_MODE\n");
@@ -161,40 +378,90 @@ static ssize_t tft_write(struct file *filp, const char __user *buf, size_t count
         else if ((randval & 0x03) == 2) randcol = BLUE;
         else randcol = (RGB){rand8(), rand8(), rand8()};
 
-        rect.x = (uint32_t)rand16() * (ILI9341_TFTWIDTH - 20) / MAX_UINT16;
-        rect.y = (uint32_t)rand16() * (ILI9341_TFTHEIGHT - 20) / MAX_UINT16;
-        rect.w = (uint32_t)rand16() * (ILI9341_TFTWIDTH - rect.x) / MAX_UINT16;
-        rect.h = (uint32_t)rand16() * (ILI9341_TFTHEIGHT - rect.y) / MAX_UINT16;
+        rect.x = (uint32_t)rand16() * (tft_spidev.width - 20) / MAX_UINT16;
+        rect.y = (uint32_t)rand16() * (tft_spidev.height - 20) / MAX_UINT16;
+        rect.w = (uint32_t)rand16() * (tft_spidev.width - rect.x) / MAX_UINT16;
+        rect.h = (uint32_t)rand16() * (tft_spidev.height - rect.y) / MAX_UINT16;
         PDEBUG("write_mode RECT_MODE: {%i, %i, %i, %i}\n", rect.x, rect.y, rect.w, rect.h);
         draw_rect(&tft_spidev, rect, randcol);
+        shadow_valid = false;
         break;
     }
-    case GIF_MODE: {
+    case RAW_MODE: {
+        size_t framebytes = TFT_NPIXELS*2, nbytes, done;
+        int err = 0;
+
+        for (done=0; done<count; done+=nbytes) {
+            nbytes = MIN(count - done, framebytes - raw_pos);
+            if (copy_from_user((void *)&frame_buffer[raw_pos], (const void __user *)&buf[done], nbytes) != 0) {
+                printk(KERN_ERR "[EFAULT] in tft_write::copy_from_user\n");
+                err = -EFAULT;
+                break;
+            }
+            raw_pos += nbytes;
+            if (raw_pos == framebytes && (err = raw_flush_frame()) != 0) {
+                done += nbytes;
+                break;
+            }
+        }
+        ncopy = done > 0 ? (ssize_t)done : err;
+        break;
+    }
+    case GIF_MODE:
+    case STREAM_MODE:
+    case PRESENT_MODE: {
         if (yidx == -1) {
             if (count != sizeof(Rect)) {
                 printk(KERN_ERR "[Bad Rect size: %zu] in tft_write\n", count);
+                ncopy = -EINVAL;
                 break;
             }
 
             // First line of an image-data-block must be rect coords of the sub-frame-window
-            ncopy = count - copy_from_user((void *)&window, (const void __user *)buf, count);
+            if (copy_from_user((void *)&window, (const void __user *)buf, count) != 0) {
+                printk(KERN_ERR "[EFAULT] in tft_write::copy_from_user\n");
+                ncopy = -EFAULT;
+                break;
+            }
+            else if (!window_valid(window)) {
+                printk(KERN_ERR "[Bad Rect: (%i, %i, %i, %i)] in tft_write\n", window.x, window.y, window.w, window.h);
+                ncopy = -EINVAL;
+                break;
+            }
+
             PDEBUG("Window %i: (%i, %i, %i, %i)\n", iframe, window.x, window.y, window.w, window.h);
             iframe += 1;
             yidx = 0;
+
+            // Stream rows into the window as they arrive, rather than buffering the frame
+            if (write_mode == STREAM_MODE) {
+                set_addr_window(&tft_spidev, window.x, window.y, window.w, window.h);
+                send_command(&tft_spidev, ILI9341_RAMWR);
+            }
+            break;
+        }
+
+        if (write_mode == STREAM_MODE) {
+            ncopy = stream_rows(buf, count);
             break;
         }
         
         if (yidx < window.h) {
             // Write to specific window in the frame_buffer
-            fidx = ((window.y + yidx)*ILI9341_TFTWIDTH + window.x)*2;
-            ncopy = count - copy_from_user((void *)&frame_buffer[fidx], (const void __user *)buf, count);
+            fidx = ((size_t)(window.y + yidx)*tft_spidev.width + window.x)*2;
+            ncopy = count - copy_from_user((void *)&frame_buffer[fidx], (const void __user *)buf, MIN(count, (size_t)window.w*2));
+            if (shadow_buffer && write_mode == GIF_MODE) diff_row(window.y + yidx, window.x, window.w);
             yidx += 1;
         }
 
         if (yidx == window.h) {
             // Update the entire frame to the TFT, screen is small enough and
             // this prevents repetitive CASET/PASET/RAMWR commands every frame
-            send_data(&tft_spidev, frame_buffer, (ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT)*2);
+            // (PRESENT_MODE frames wait in frame_buffer for SPITFT_IOCPRESENT)
+            if (write_mode == GIF_MODE && shadow_buffer)
+                flush_dirty();
+            else if (write_mode == GIF_MODE)
+                send_pixels(&tft_spidev, frame_buffer, TFT_NPIXELS);
             yidx = -1;
         }
         break;
@@ -204,38 +471,936 @@ static ssize_t tft_write(struct file *filp, const char __user *buf, size_t count
         break;
     }
 
-    if (write_mode != GIF_MODE) kfree((void *)inbuffer);
+    mutex_unlock(&tft_mutex);
     return ncopy;
 }
 
-// Read ioctl command from user space and apply the requested write_mode
-long tft_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
-	// Validate cmd is the one we recognize
-	if (_IOC_TYPE(cmd) != SPITFT_IOC_MAGIC || _IOC_NR(cmd) > SPITFT_IOC_MAXNR || cmd != SPITFT_IOCWRMODE) {
-        printk(KERN_ERR "[ENOTTY] in tft_ioctl\n");
-        return -ENOTTY;
+// Set the address window to the full (logical) panel and start a RAMWR that
+// subsequent GIF_MODE frame_buffer sends continue
+static void begin_frame_write(void) {
+    set_addr_window(&tft_spidev, 0, 0, tft_spidev.width, tft_spidev.height);
+    send_command(&tft_spidev, ILI9341_RAMWR);
+}
+
+// Restore the RAMWR state the current write_mode expects after another path
+// (sprite or V4L2 flush) has moved the address window
+static void resume_write(void) {
+    if (write_mode == GIF_MODE) {
+        begin_frame_write();
     }
-    else if (copy_from_user((void *)&write_mode, (const void __user *)arg, sizeof(uint8_t)) != 0) {
-        printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_from_user\n");
-        return -EFAULT; 
+    else if (write_mode == STREAM_MODE && yidx >= 0) {
+        // Reopen on the rows of the window not yet streamed
+        set_addr_window(&tft_spidev, window.x, window.y + yidx, window.w, window.h - yidx);
+        send_command(&tft_spidev, ILI9341_RAMWR);
+    }
+}
+
+// Send a window of a frame-sized buffer to the TFT, full-width windows go in one transfer
+static int flush_window(const uint8_t *buffer, Rect rect) {
+    uint32_t stride = tft_spidev.width * 2;
+    uint32_t fidx = rect.y*stride + rect.x*2;
+    int err;
+
+    set_addr_window(&tft_spidev, rect.x, rect.y, rect.w, rect.h);
+    send_command(&tft_spidev, ILI9341_RAMWR);
+    if (rect.w == tft_spidev.width) {
+        err = send_pixels(&tft_spidev, &buffer[fidx], rect.w * rect.h);
+    }
+    else {
+        err = 0;
+        for (int i=0; i<rect.h && err == 0; ++i, fidx += stride)
+            err = send_pixels(&tft_spidev, &buffer[fidx], rect.w);
+    }
+
+    // NOP to terminate RAMWR cmd
+    send_command(&tft_spidev, ILI9341_NOP);
+
+    // Keep the diffing shadow in step with what was just sent
+    if (shadow_buffer && buffer != shadow_buffer) {
+        fidx = rect.y*stride + rect.x*2;
+        for (int i=0; i<rect.h; ++i, fidx += stride)
+            memcpy((void *)&shadow_buffer[fidx], (const void *)&buffer[fidx], rect.w * 2);
+    }
+    return err;
+}
+
+// Flush the dirty rows of the frame_buffer as few windows as practical: dirty rows
+// (bridging up to DIFF_MAX_GAP clean rows, cheaper than new CASET/PASET/RAMWR) merge
+// into their bounding box. Everything is sent if the shadow isn't known to match the TFT
+static int flush_dirty(void) {
+    Rect rect = { 0, 0, 0, 0 };
+    int x0 = INT_MAX, x1 = -1, first = -1, last = -1;
+    int height = tft_spidev.height, err = 0, nrects = 0;
+
+    if (!shadow_valid) {
+        err = flush_window(frame_buffer, (Rect){ 0, 0, tft_spidev.width, tft_spidev.height });
+        reset_dirty_spans();
+        shadow_valid = (err == 0);
+        resume_write();
+        return err;
     }
-    else if (write_mode > GIF_MODE) {
-        printk(KERN_ERR "[EINVAL %u] in tft_ioctl\n", write_mode);
-        write_mode = NOP_MODE;
+
+    // Every panel row, not only the window's: SPRITE_FRAMEBUF draws dirty rows too
+    for (int y=0; y<=height && err == 0; ++y) {
+        DirtySpan *span = &dirty_spans[MIN(y, height - 1)];
+        bool dirty = y < height && span->x0 <= span->x1;
+
+        // Close the open rect at the end of the panel or past a long clean gap
+        if (first >= 0 && (y == height || (dirty && y - last > DIFF_MAX_GAP + 1))) {
+            rect = (Rect){ x0, first, x1 - x0 + 1, last - first + 1 };
+            err = flush_window(frame_buffer, rect);
+            nrects += 1;
+            x0 = INT_MAX; x1 = -1; first = -1;
+        }
+        if (!dirty) continue;
+
+        if (first < 0) first = y;
+        x0 = MIN(x0, (int)span->x0);
+        x1 = MAX(x1, (int)span->x1);
+        last = y;
+        *span = (DirtySpan){ 0xFFFF, 0 };
+    }
+
+    PDEBUG("flush_dirty: %i windows\n", nrects);
+    if (nrects > 0) resume_write();
+    return err;
+}
+
+// RAW_MODE: writes are a byte stream of back-to-back full frames (MSB-first RGB-565), each
+// flushed (or diffed, with SPITFT_IOCSDIFF) as its last byte lands in frame_buffer
+static int raw_flush_frame(void) {
+    raw_pos = 0;
+    if (shadow_buffer) {
+        for (int y=0; y<tft_spidev.height; ++y) diff_row(y, 0, tft_spidev.width);
+        return flush_dirty();
+    }
+    return flush_window(frame_buffer, (Rect){ 0, 0, tft_spidev.width, tft_spidev.height });
+}
+
+// RAW_MODE frames from an iov_iter (write_iter, and so splice/sendfile)
+static ssize_t raw_write(struct iov_iter *from) {
+    size_t framebytes = TFT_NPIXELS*2, nbytes, ncopy;
+    ssize_t total = 0;
+    int err;
+
+    while (iov_iter_count(from) > 0) {
+        nbytes = MIN(iov_iter_count(from), framebytes - raw_pos);
+        ncopy = copy_from_iter((void *)&frame_buffer[raw_pos], nbytes, from);
+        raw_pos += ncopy;
+        total += ncopy;
+        if (ncopy < nbytes) {
+            printk(KERN_ERR "[EFAULT] in raw_write::copy_from_iter\n");
+            return total > 0 ? total : -EFAULT;
+        }
+        if (raw_pos < framebytes) break;
+
+        if ((err = raw_flush_frame()) != 0) return total > 0 ? total : err;
+    }
+    return total;
+}
+
+// write_iter backs splice/sendfile (through iter_file_splice_write), so the page cache
+// pages of a raw clip are copied straight into frame_buffer without a userspace bounce.
+// It also receives writev/pwritev/io_uring writes, whose segments each go through
+// tft_write since the other modes frame their protocol by write (a Rect, then rows)
+static ssize_t tft_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct iovec iov;
+    ssize_t ret = 0, total = 0;
+
+    if (user_backed_iter(from)) {
+        while (iov_iter_count(from) > 0) {
+            iov = iov_iter_iovec(from);
+            if (iov.iov_len == 0) break; // not every kernel's iov_iter_advance skips these
+            if ((ret = tft_write(iocb->ki_filp, iov.iov_base, iov.iov_len, &iocb->ki_pos)) < 0) break;
+
+            iov_iter_advance(from, ret);
+            total += ret;
+            if ((size_t)ret < iov.iov_len) break; // short write ends the batch
+        }
+        return total > 0 ? total : ret;
+    }
+
+    // Spliced pages carry no write boundaries, only RAW_MODE's byte stream can take them
+    if (mutex_lock_interruptible(&tft_mutex))
+        return -ERESTARTSYS;
+
+    if (write_mode == RAW_MODE) {
+        ret = raw_write(from);
+    }
+    else {
+        printk(KERN_ERR "[EINVAL splice in write_mode %u] in tft_write_iter\n", write_mode);
+        ret = -EINVAL;
+    }
+
+    mutex_unlock(&tft_mutex);
+    return ret;
+}
+
+static void sprite_release(Sprite *sprite) {
+    sprite_bytes -= sprite->w * sprite->h * 2;
+    kfree((void *)sprite->pixels);
+    memset(sprite, 0, sizeof(Sprite));
+}
+
+static Sprite *sprite_find(int32_t handle) {
+    for (int i=0; i<SPRITE_NSLOTS; ++i)
+        if (handle > 0 && sprite_cache[i].handle == handle) 
+            return &sprite_cache[i];
+    return NULL;
+}
+
+// Returns a free slot, evicting least-recently-used sprites until nbytes more fit
+static Sprite *sprite_reserve(size_t nbytes) {
+    Sprite *free, *lru;
+
+    while (true) {
+        free = lru = NULL;
+        for (int i=0; i<SPRITE_NSLOTS; ++i) {
+            if (sprite_cache[i].handle == 0) { if (!free) free = &sprite_cache[i]; }
+            else if (!lru || sprite_cache[i].last_use < lru->last_use) lru = &sprite_cache[i];
+        }
+
+        if (free && sprite_bytes + nbytes <= sprite_cache_kb * 1024UL) return free;
+        if (!lru) return NULL;
+
+        PDEBUG("evict sprite %i (%ux%u) in sprite_reserve\n", lru->handle, lru->w, lru->h);
+        sprite_release(lru);
+    }
+}
+
+static int sprite_upload(SpriteUpload *upload) {
+    size_t nbytes = (size_t)upload->w * upload->h * 2;
+    uint16_t maxdim = MAX(tft_spidev.panel->width, tft_spidev.panel->height);
+    Sprite *sprite;
+    uint8_t *pixels;
+
+    if (nbytes == 0 || upload->w > maxdim || upload->h > maxdim) {
+        printk(KERN_ERR "[EINVAL %ux%u] in sprite_upload\n", upload->w, upload->h);
         return -EINVAL;
     }
+    else if (nbytes > sprite_cache_kb * 1024UL) {
+        printk(KERN_ERR "[ENOSPC %zu] in sprite_upload\n", nbytes);
+        return -ENOSPC;
+    }
 
-    if (write_mode == GIF_MODE) {
-        set_addr_window(&tft_spidev, 0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT);
-        send_command(&tft_spidev, ILI9341_RAMWR);
-    } 
+    // Copy in before evicting anything, so a bad pointer leaves the cache intact
+    if ((pixels = (uint8_t *)kmalloc(nbytes, GFP_KERNEL)) == NULL) {
+        printk(KERN_ERR "[ENOMEM] in sprite_upload::kmalloc\n");
+        return -ENOMEM;
+    }
+    else if (copy_from_user((void *)pixels, (const void __user *)upload->pixels, nbytes) != 0) {
+        printk(KERN_ERR "[EFAULT] in sprite_upload::copy_from_user\n");
+        kfree((void *)pixels);
+        return -EFAULT;
+    }
+
+    if ((sprite = sprite_reserve(nbytes)) == NULL) {
+        printk(KERN_ERR "[ENOSPC %zu] in sprite_upload::sprite_reserve\n", nbytes);
+        kfree((void *)pixels);
+        return -ENOSPC;
+    }
+
+    sprite_handle = sprite_handle == INT_MAX ? 1 : sprite_handle + 1;
+    *sprite = (Sprite){ sprite_handle, upload->w, upload->h, ++sprite_clock, pixels };
+    sprite_bytes += nbytes;
+
+    upload->handle = sprite->handle;
+    PDEBUG("upload sprite %i (%ux%u), cache %zu bytes\n", sprite->handle, sprite->w, sprite->h, sprite_bytes);
+    return 0;
+}
+
+static int sprite_draw(const SpriteDraw *draw) {
+    Sprite *sprite;
+    Rect rect;
+    int sx, sy;
+
+    if ((sprite = sprite_find(draw->handle)) == NULL) {
+        PDEBUG("[ENOENT %i] in sprite_draw\n", draw->handle);
+        return -ENOENT;
+    }
+    else if (draw->target > SPRITE_PANEL) {
+        printk(KERN_ERR "[EINVAL target %u] in sprite_draw\n", draw->target);
+        return -EINVAL;
+    }
+
+    // Clip against the (logical) panel, (sx, sy) is the first visible sprite pixel. In
+    // 64-bit, negating a user INT_MIN position would overflow an int
+    sprite->last_use = ++sprite_clock;
+    if ((int64_t)draw->x <= -(int64_t)sprite->w || draw->x >= (int)tft_spidev.width ||
+        (int64_t)draw->y <= -(int64_t)sprite->h || draw->y >= (int)tft_spidev.height)
+        return 0;
+
+    sx = (int)MAX(-(int64_t)draw->x, 0);
+    sy = (int)MAX(-(int64_t)draw->y, 0);
+    rect.x = MAX(draw->x, 0);
+    rect.y = MAX(draw->y, 0);
+    rect.w = MIN(sprite->w - sx, (int)tft_spidev.width - rect.x);
+    rect.h = MIN(sprite->h - sy, (int)tft_spidev.height - rect.y);
+
+    for (int i=0; i<rect.h; ++i) {
+        memcpy((void *)&frame_buffer[((rect.y + i)*tft_spidev.width + rect.x)*2],
+            (const void *)&sprite->pixels[((sy + i)*sprite->w + sx)*2], rect.w*2);
+        // Shown with the next frame, which only sends dirty rows while diffing
+        if (shadow_buffer && draw->target == SPRITE_FRAMEBUF) diff_row(rect.y + i, rect.x, rect.w);
+    }
+
+    if (draw->target == SPRITE_PANEL) {
+        flush_window(frame_buffer, rect);
+        resume_write();
+    }
+    return 0;
+}
+
+#ifdef SPI_TFT_V4L2
+// V4L2 output device (/dev/videoN): frames queued through videobuf2 (MMAP, USERPTR,
+// DMABUF or write()) are converted into frame_buffer and flushed like GIF_MODE frames
+
+typedef struct {
+    struct vb2_v4l2_buffer vb; // must be first, vb2 allocates buf_struct_size
+    struct list_head list;
+} VideoBuffer;
+
+static const uint32_t video_formats[] = {
+    V4L2_PIX_FMT_RGB565,  // little-endian, byte-swapped into frame_buffer
+    V4L2_PIX_FMT_RGB565X, // big-endian, native TFT byte order
+    V4L2_PIX_FMT_RGB24,   // packed to RGB-565
+};
+
+static struct v4l2_device video_v4l2_dev;
+static struct video_device video_vdev;
+static struct vb2_queue video_queue;
+static struct v4l2_pix_format video_format;
+static DEFINE_MUTEX(video_mutex);
+
+static LIST_HEAD(video_buffers);
+static DEFINE_SPINLOCK(video_lock);
+static struct work_struct video_work;
+static uint32_t video_sequence = 0;
+
+// Convert one frame of video_format pixels into frame_buffer
+static void video_convert_frame(const uint8_t *src) {
+    uint32_t npixels = video_format.width * video_format.height;
+    uint8_t *dst = frame_buffer;
+
+    switch (video_format.pixelformat) {
+    case V4L2_PIX_FMT_RGB565X:
+        memcpy((void *)dst, (const void *)src, npixels*2);
+        break;
+    case V4L2_PIX_FMT_RGB565:
+        for (uint32_t i=0; i<npixels; ++i, src += 2) {
+            *dst++ = src[1];
+            *dst++ = src[0];
+        }
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        // Stored inline, the core's pack_MSB16 isn't exported from spitft.ko
+        for (uint32_t i=0; i<npixels; ++i, src += 3) {
+            *dst++ = (src[0] & 0xF8) | (src[1] >> 5);
+            *dst++ = ((src[1] & 0x1C) << 3) | (src[2] >> 3);
+        }
+        break;
+    }
+}
+
+static void video_work_fn(struct work_struct *work) {
+    VideoBuffer *buf;
+    unsigned long flags;
+    int err;
+
+    while (true) {
+        spin_lock_irqsave(&video_lock, flags);
+        buf = list_first_entry_or_null(&video_buffers, VideoBuffer, list);
+        if (buf) list_del(&buf->list);
+        spin_unlock_irqrestore(&video_lock, flags);
+        if (!buf) break;
+
+        mutex_lock(&tft_mutex);
+        if (video_format.width != tft_spidev.width || video_format.height != tft_spidev.height) {
+            // Buffers laid out for another rotation, never flush them onto this geometry
+            printk(KERN_ERR "[EINVAL %ux%u format on %ux%u panel] in video_work_fn\n",
+                video_format.width, video_format.height, tft_spidev.width, tft_spidev.height);
+            err = -EINVAL;
+        }
+        else {
+            video_convert_frame((const uint8_t *)vb2_plane_vaddr(&buf->vb.vb2_buf, 0));
+            err = flush_window(frame_buffer, (Rect){ 0, 0, tft_spidev.width, tft_spidev.height });
+            resume_write();
+        }
+        mutex_unlock(&tft_mutex);
+
+        buf->vb.sequence = video_sequence++;
+        vb2_buffer_done(&buf->vb.vb2_buf, err == 0 ? VB2_BUF_STATE_DONE : VB2_BUF_STATE_ERROR);
+    }
+}
+
+static void video_return_buffers(enum vb2_buffer_state state) {
+    VideoBuffer *buf, *tmp;
+    unsigned long flags;
+
+    spin_lock_irqsave(&video_lock, flags);
+    list_for_each_entry_safe(buf, tmp, &video_buffers, list) {
+        list_del(&buf->list);
+        vb2_buffer_done(&buf->vb.vb2_buf, state);
+    }
+    spin_unlock_irqrestore(&video_lock, flags);
+}
+
+static void video_refresh_format(void);
+
+static int video_queue_setup(struct vb2_queue *vq, unsigned int *nbuffers,
+    unsigned int *nplanes, unsigned int sizes[], struct device *alloc_devs[]) {
+    // SPITFT_IOCSROTATE may have changed the geometry since S_FMT (it is refused
+    // from here on, while the queue holds buffers)
+    if (!vb2_is_busy(vq)) {
+        mutex_lock(&tft_mutex);
+        video_refresh_format();
+        mutex_unlock(&tft_mutex);
+    }
+
+    if (*nplanes) 
+        return sizes[0] < video_format.sizeimage ? -EINVAL : 0;
+
+    *nplanes = 1;
+    sizes[0] = video_format.sizeimage;
+    return 0;
+}
+
+static int video_buf_prepare(struct vb2_buffer *vb) {
+    if (vb2_get_plane_payload(vb, 0) < video_format.sizeimage) {
+        PDEBUG("[EINVAL payload %lu] in video_buf_prepare\n", vb2_get_plane_payload(vb, 0));
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void video_buf_queue(struct vb2_buffer *vb) {
+    VideoBuffer *buf = container_of(to_vb2_v4l2_buffer(vb), VideoBuffer, vb);
+    unsigned long flags;
+
+    spin_lock_irqsave(&video_lock, flags);
+    list_add_tail(&buf->list, &video_buffers);
+    spin_unlock_irqrestore(&video_lock, flags);
+    schedule_work(&video_work);
+}
+
+static int video_start_streaming(struct vb2_queue *vq, unsigned int count) {
+    video_sequence = 0;
+    return 0;
+}
+
+static void video_stop_streaming(struct vb2_queue *vq) {
+    cancel_work_sync(&video_work);
+    video_return_buffers(VB2_BUF_STATE_ERROR);
+}
+
+static const struct vb2_ops video_vb2_ops = {
+    .queue_setup =      video_queue_setup,
+    .buf_prepare =      video_buf_prepare,
+    .buf_queue =        video_buf_queue,
+    .start_streaming =  video_start_streaming,
+    .stop_streaming =   video_stop_streaming,
+    .wait_prepare =     vb2_ops_wait_prepare,
+    .wait_finish =      vb2_ops_wait_finish,
+};
+
+static int video_querycap(struct file *file, void *priv, struct v4l2_capability *cap) {
+    strscpy(cap->driver, "spitft", sizeof(cap->driver));
+    snprintf(cap->card, sizeof(cap->card), "%s SPI TFT", tft_spidev.panel->name);
+    snprintf(cap->bus_info, sizeof(cap->bus_info), "spi:%s", dev_name(video_v4l2_dev.dev));
+    return 0;
+}
+
+static int video_enum_fmt(struct file *file, void *priv, struct v4l2_fmtdesc *f) {
+    if (f->index >= ARRAY_SIZE(video_formats)) return -EINVAL;
+    f->pixelformat = video_formats[f->index];
+    return 0;
+}
+
+static int video_g_fmt(struct file *file, void *priv, struct v4l2_format *f) {
+    if (!vb2_is_busy(&video_queue)) {
+        mutex_lock(&tft_mutex);
+        video_refresh_format();
+        mutex_unlock(&tft_mutex);
+    }
+    f->fmt.pix = video_format;
+    return 0;
+}
+
+// Size is always the current (logical) panel geometry, only the pixel format is negotiable
+static int video_try_fmt(struct file *file, void *priv, struct v4l2_format *f) {
+    struct v4l2_pix_format *pix = &f->fmt.pix;
+    uint32_t bpp = 2;
+    unsigned int i;
+
+    for (i=0; i<ARRAY_SIZE(video_formats) && video_formats[i] != pix->pixelformat; ++i);
+    if (i == ARRAY_SIZE(video_formats)) pix->pixelformat = video_formats[0];
+    if (pix->pixelformat == V4L2_PIX_FMT_RGB24) bpp = 3;
+
+    pix->width = tft_spidev.width;
+    pix->height = tft_spidev.height;
+    pix->field = V4L2_FIELD_NONE;
+    pix->bytesperline = pix->width * bpp;
+    pix->sizeimage = pix->bytesperline * pix->height;
+    pix->colorspace = V4L2_COLORSPACE_SRGB;
+    pix->ycbcr_enc = V4L2_YCBCR_ENC_DEFAULT;
+    pix->quantization = V4L2_QUANTIZATION_DEFAULT;
+    pix->xfer_func = V4L2_XFER_FUNC_DEFAULT;
+    return 0;
+}
+
+// Re-derive video_format's size from the current panel geometry, keeping its pixel format
+static void video_refresh_format(void) {
+    struct v4l2_format fmt = { .type = V4L2_BUF_TYPE_VIDEO_OUTPUT };
+    fmt.fmt.pix.pixelformat = video_format.pixelformat;
+    video_try_fmt(NULL, NULL, &fmt);
+    video_format = fmt.fmt.pix;
+}
+
+static int video_s_fmt(struct file *file, void *priv, struct v4l2_format *f) {
+    if (vb2_is_busy(&video_queue)) return -EBUSY;
+    video_try_fmt(file, priv, f);
+    video_format = f->fmt.pix;
+    return 0;
+}
+
+static int video_enum_output(struct file *file, void *priv, struct v4l2_output *out) {
+    if (out->index > 0) return -EINVAL;
+    strscpy(out->name, "TFT", sizeof(out->name));
+    out->type = V4L2_OUTPUT_TYPE_ANALOG;
+    return 0;
+}
+
+static int video_g_output(struct file *file, void *priv, unsigned int *i) {
+    *i = 0;
+    return 0;
+}
+
+static int video_s_output(struct file *file, void *priv, unsigned int i) {
+    return i == 0 ? 0 : -EINVAL;
+}
+
+static const struct v4l2_ioctl_ops video_ioctl_ops = {
+    .vidioc_querycap =          video_querycap,
+    .vidioc_enum_fmt_vid_out =  video_enum_fmt,
+    .vidioc_g_fmt_vid_out =     video_g_fmt,
+    .vidioc_try_fmt_vid_out =   video_try_fmt,
+    .vidioc_s_fmt_vid_out =     video_s_fmt,
+    .vidioc_enum_output =       video_enum_output,
+    .vidioc_g_output =          video_g_output,
+    .vidioc_s_output =          video_s_output,
+    .vidioc_reqbufs =           vb2_ioctl_reqbufs,
+    .vidioc_create_bufs =       vb2_ioctl_create_bufs,
+    .vidioc_prepare_buf =       vb2_ioctl_prepare_buf,
+    .vidioc_querybuf =          vb2_ioctl_querybuf,
+    .vidioc_qbuf =              vb2_ioctl_qbuf,
+    .vidioc_dqbuf =             vb2_ioctl_dqbuf,
+    .vidioc_expbuf =            vb2_ioctl_expbuf,
+    .vidioc_streamon =          vb2_ioctl_streamon,
+    .vidioc_streamoff =         vb2_ioctl_streamoff,
+};
+
+static const struct v4l2_file_operations video_fops = {
+    .owner =            THIS_MODULE,
+    .open =             v4l2_fh_open,
+    .release =          vb2_fop_release,
+    .write =            vb2_fop_write,
+    .poll =             vb2_fop_poll,
+    .mmap =             vb2_fop_mmap,
+    .unlocked_ioctl =   video_ioctl2,
+};
+
+static int video_register(struct device *dev) {
+    int err;
+
+    INIT_WORK(&video_work, video_work_fn);
+    video_format.pixelformat = video_formats[0];
+    video_refresh_format();
+
+    if ((err = v4l2_device_register(dev, &video_v4l2_dev)) != 0) {
+        printk(KERN_ERR "[errno %i] in video_register::v4l2_device_register\n", -err);
+        return err;
+    }
+
+    video_queue = (struct vb2_queue){
+        .type = V4L2_BUF_TYPE_VIDEO_OUTPUT,
+        .io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_WRITE,
+        .buf_struct_size = sizeof(VideoBuffer),
+        .ops = &video_vb2_ops,
+        .mem_ops = &vb2_vmalloc_memops,
+        .timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY,
+        .lock = &video_mutex,
+        .dev = dev,
+    };
+    if ((err = vb2_queue_init(&video_queue)) != 0) {
+        printk(KERN_ERR "[errno %i] in video_register::vb2_queue_init\n", -err);
+        v4l2_device_unregister(&video_v4l2_dev);
+        return err;
+    }
+
+    video_vdev = (struct video_device){
+        .name = "tftchar",
+        .fops = &video_fops,
+        .ioctl_ops = &video_ioctl_ops,
+        .release = video_device_release_empty,
+        .v4l2_dev = &video_v4l2_dev,
+        .queue = &video_queue,
+        .lock = &video_mutex,
+        .vfl_dir = VFL_DIR_TX,
+        .device_caps = V4L2_CAP_VIDEO_OUTPUT | V4L2_CAP_STREAMING | V4L2_CAP_READWRITE,
+    };
+    if ((err = video_register_device(&video_vdev, VFL_TYPE_VIDEO, -1)) != 0) {
+        printk(KERN_ERR "[errno %i] in video_register::video_register_device\n", -err);
+        vb2_queue_release(&video_queue);
+        v4l2_device_unregister(&video_v4l2_dev);
+        return err;
+    }
+
+    printk(KERN_NOTICE "tftchar V4L2 output registered as %s\n", video_device_node_name(&video_vdev));
+    return 0;
+}
+
+static void video_unregister(void) {
+    if (!video_is_registered(&video_vdev)) return;
+    vb2_video_unregister_device(&video_vdev);
+    v4l2_device_unregister(&video_v4l2_dev);
+}
+
+static bool video_busy(void) {
+    return video_is_registered(&video_vdev) && vb2_is_busy(&video_queue);
+}
+#else
+static bool video_busy(void) { return false; }
+#endif // SPI_TFT_V4L2
+
+// Present queue: SPITFT_IOCPRESENT snapshots frame_buffer into a slot with a target
+// time, an hrtimer fires present_flush_ns before the head slot's target and the
+// (sleepable) present_work flushes it, recording the actual timing as feedback
+
+// Arm present_timer for the head slot, called with present_lock held
+static void present_arm_timer(void) {
+    uint64_t target, start;
+
+    if (present_count == 0) return;
+    target = present_queue[present_head].request.target_ns;
+    start = target > present_flush_ns ? target - present_flush_ns : 0;
+    hrtimer_start(&present_timer, ns_to_ktime(start), HRTIMER_MODE_ABS);
+}
+
+static enum hrtimer_restart present_timer_fn(struct hrtimer *timer) {
+    queue_work(present_wq, &present_work);
+    return HRTIMER_NORESTART;
+}
+
+static void present_work_fn(struct work_struct *work) {
+    PresentFeedback feedback;
+    PresentSlot *slot;
+    unsigned long flags;
+    uint64_t elapsed;
+
+    spin_lock_irqsave(&present_lock, flags);
+    slot = present_count > 0 ? &present_queue[present_head] : NULL;
+    spin_unlock_irqrestore(&present_lock, flags);
+    if (!slot) return;
+
+    mutex_lock(&tft_mutex);
+    feedback.start_ns = ktime_get_ns();
+    flush_window(slot->pixels, (Rect){ 0, 0, tft_spidev.width, tft_spidev.height });
+    feedback.present_ns = ktime_get_ns();
+    resume_write();
+    mutex_unlock(&tft_mutex);
+
+    // Exponential moving average (1/4 weight) of the flush time, used to lead the target
+    elapsed = feedback.present_ns - feedback.start_ns;
+    present_flush_ns = present_flush_ns ? (3*present_flush_ns + elapsed) / 4 : elapsed;
+
+    feedback.id = slot->request.id;
+    feedback.target_ns = slot->request.target_ns;
+    PDEBUG("present %u: target %llu, late %lld ns\n", feedback.id, feedback.target_ns,
+        (int64_t)(feedback.present_ns - feedback.target_ns));
+
+    spin_lock_irqsave(&present_lock, flags);
+    if (kfifo_is_full(&present_feedback)) kfifo_skip(&present_feedback); // drop oldest
+    kfifo_put(&present_feedback, feedback);
+    if (present_count > 0) { // else the queue was dropped by present_free
+        present_head = (present_head + 1) % PRESENT_DEPTH;
+        present_count -= 1;
+    }
+    present_arm_timer();
+    spin_unlock_irqrestore(&present_lock, flags);
+    wake_up_interruptible(&present_wait);
+}
+
+static int present_submit(struct file *filp, const PresentRequest *request) {
+    PresentSlot *slot;
+    unsigned long flags;
+    int err;
+
+    // Wait for a free slot without tft_mutex held, present_work needs it to drain the queue
+retry:
+    if (READ_ONCE(present_count) >= PRESENT_DEPTH) {
+        if (filp->f_flags & O_NONBLOCK) return -EAGAIN;
+        if (wait_event_interruptible(present_wait, READ_ONCE(present_count) < PRESENT_DEPTH))
+            return -ERESTARTSYS;
+    }
+
+    if (mutex_lock_interruptible(&tft_mutex))
+        return -ERESTARTSYS;
+
+    err = 0;
+    if (write_mode != PRESENT_MODE || present_queue[0].pixels == NULL) {
+        printk(KERN_ERR "[EINVAL write_mode %u] in present_submit\n", write_mode);
+        err = -EINVAL;
+    }
+    else if (yidx != -1) {
+        // A partial window would queue a torn frame
+        printk(KERN_ERR "[EBUSY window row %i] in present_submit\n", yidx);
+        err = -EBUSY;
+    }
+    else if (request->target_ns > ktime_get_ns() + PRESENT_MAX_LEAD_NS) {
+        // The queue is FIFO, a far-future (or CLOCK_REALTIME) target would stall every later frame
+        printk(KERN_ERR "[EINVAL target_ns %llu] in present_submit\n", request->target_ns);
+        err = -EINVAL;
+    }
+    else if (present_count >= PRESENT_DEPTH) {
+        // Another submitter took the freed slot, blocking callers go back to waiting
+        if (!(filp->f_flags & O_NONBLOCK)) {
+            mutex_unlock(&tft_mutex);
+            goto retry;
+        }
+        err = -EAGAIN;
+    }
+    else {
+        // Only this (mutex-holding) path adds slots, so the tail is ours until published
+        spin_lock_irqsave(&present_lock, flags);
+        slot = &present_queue[(present_head + present_count) % PRESENT_DEPTH];
+        spin_unlock_irqrestore(&present_lock, flags);
+
+        memcpy((void *)slot->pixels, (const void *)frame_buffer, TFT_NPIXELS*2);
+        slot->request = *request;
+
+        spin_lock_irqsave(&present_lock, flags);
+        present_count += 1;
+        if (present_count == 1) present_arm_timer();
+        spin_unlock_irqrestore(&present_lock, flags);
+    }
+
+    mutex_unlock(&tft_mutex);
+    return err;
+}
+
+static int present_alloc(void) {
+    for (int i=0; i<PRESENT_DEPTH; ++i) {
+        if (present_queue[i].pixels) continue;
+        if ((present_queue[i].pixels = (uint8_t *)kmalloc(TFT_NPIXELS*2, GFP_KERNEL)) == NULL) {
+            printk(KERN_ERR "[ENOMEM] in present_alloc::kmalloc\n");
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static void present_free(void) {
+    unsigned long flags;
+
+    // Drop queued frames first so an in-flight flush doesn't re-arm the timer
+    spin_lock_irqsave(&present_lock, flags);
+    present_count = 0;
+    spin_unlock_irqrestore(&present_lock, flags);
+
+    hrtimer_cancel(&present_timer);
+    if (present_wq) destroy_workqueue(present_wq);
+    for (int i=0; i<PRESENT_DEPTH; ++i)
+        kfree(present_queue[i].pixels);
+}
+
+// Present ioctls run outside tft_mutex since SPITFT_IOCPRESENT may block
+static long present_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    PresentRequest request;
+    PresentFeedback feedback;
+
+    if (cmd == SPITFT_IOCPRESENT) {
+        if (copy_from_user((void *)&request, (const void __user *)arg, sizeof(PresentRequest)) != 0) {
+            printk(KERN_ERR "[EFAULT] in present_ioctl::__copy_from_user\n");
+            return -EFAULT; 
+        }
+        return present_submit(filp, &request);
+    }
+
+    if (!kfifo_out_spinlocked(&present_feedback, &feedback, 1, &present_lock))
+        return -EAGAIN;
+    else if (copy_to_user((void __user *)arg, (const void *)&feedback, sizeof(PresentFeedback)) != 0) {
+        printk(KERN_ERR "[EFAULT] in present_ioctl::__copy_to_user\n");
+        return -EFAULT; 
+    }
+    return 0;
+}
+
+static void diff_free(void) {
+    kfree((void *)shadow_buffer);
+    kfree((void *)dirty_spans);
+    shadow_buffer = NULL;
+    dirty_spans = NULL;
+}
+
+static int diff_enable(bool enable) {
+    uint16_t maxdim = MAX(tft_spidev.panel->width, tft_spidev.panel->height);
+
+    if (!enable || shadow_buffer) {
+        if (!enable) diff_free();
+        return 0;
+    }
+
+    shadow_buffer = (uint8_t *)kmalloc(TFT_NPIXELS*2, GFP_KERNEL);
+    dirty_spans = (DirtySpan *)kmalloc(maxdim * sizeof(DirtySpan), GFP_KERNEL);
+    if (!shadow_buffer || !dirty_spans) {
+        printk(KERN_ERR "[ENOMEM] in diff_enable::kmalloc\n");
+        diff_free();
+        return -ENOMEM;
+    }
+
+    // TFT contents are unknown until the next frame is sent whole
+    reset_dirty_spans();
+    shadow_valid = false;
+    return 0;
+}
+
+// Read ioctl command from user space and apply the requested write_mode, rotation or sprite op
+static long tft_ioctl_locked(struct file *filp, unsigned int cmd, unsigned long arg) {
+    SpriteUpload upload;
+    SpriteDraw draw;
+    Sprite *sprite;
+    int32_t handle;
+    uint8_t rotation;
+    int err;
+
+	// Validate cmd is one we recognize
+	if (_IOC_TYPE(cmd) != SPITFT_IOC_MAGIC || _IOC_NR(cmd) > SPITFT_IOC_MAXNR) {
+        printk(KERN_ERR "[ENOTTY] in tft_ioctl\n");
+        return -ENOTTY;
+    }
+
+    switch (cmd) {
+    case SPITFT_IOCWRMODE: {
+        if (copy_from_user((void *)&write_mode, (const void __user *)arg, sizeof(uint8_t)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_from_user\n");
+            return -EFAULT; 
+        }
+        else if (write_mode > RAW_MODE) {
+            printk(KERN_ERR "[EINVAL %u] in tft_ioctl\n", write_mode);
+            write_mode = NOP_MODE;
+            return -EINVAL;
+        }
+        else if (write_mode == PRESENT_MODE && (err = present_alloc()) != 0) {
+            write_mode = NOP_MODE;
+            return err;
+        }
+
+        // Any partial window or frame belongs to the previous mode's protocol
+        yidx = -1;
+        raw_pos = 0;
+        if (write_mode == GIF_MODE) begin_frame_write();
+        PDEBUG("set write_mode: %u in tft_ioctl\n", write_mode);
+        break;
+    }
+    case SPITFT_IOCSROTATE: {
+        if (copy_from_user((void *)&rotation, (const void __user *)arg, sizeof(uint8_t)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_from_user\n");
+            return -EFAULT; 
+        }
+        else if (video_busy() || READ_ONCE(present_count) > 0) {
+            // Queued V4L2 buffers and present slots are laid out in the current geometry
+            printk(KERN_ERR "[EBUSY] in tft_ioctl\n");
+            return -EBUSY;
+        }
+        else if ((err = set_rotation(&tft_spidev, rotation)) != 0) {
+            return err;
+        }
+
+        // Buffered pixels (and any partial window) were laid out in the old geometry
+        memset(frame_buffer, 0, TFT_NPIXELS*2);
+        shadow_valid = false;
+        yidx = -1;
+        raw_pos = 0;
+
+        if (write_mode == GIF_MODE) begin_frame_write();
+        PDEBUG("set rotation: 0x%02X (%ux%u) in tft_ioctl\n", rotation, tft_spidev.width, tft_spidev.height);
+        break;
+    }
+    case SPITFT_IOCSDIFF: {
+        uint8_t enable;
+        if (copy_from_user((void *)&enable, (const void __user *)arg, sizeof(uint8_t)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_from_user\n");
+            return -EFAULT; 
+        }
+        return diff_enable(enable != 0);
+    }
+    case SPITFT_IOCGGEOMETRY: {
+        Rect geometry = { 0, 0, tft_spidev.width, tft_spidev.height };
+        if (copy_to_user((void __user *)arg, (const void *)&geometry, sizeof(Rect)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_to_user\n");
+            return -EFAULT; 
+        }
+        break;
+    }
+    case SPITFT_IOCUPLOADSPRITE: {
+        if (copy_from_user((void *)&upload, (const void __user *)arg, sizeof(SpriteUpload)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_from_user\n");
+            return -EFAULT; 
+        }
+        else if ((err = sprite_upload(&upload)) != 0) {
+            return err;
+        }
+        else if (copy_to_user((void __user *)arg, (const void *)&upload, sizeof(SpriteUpload)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_to_user\n");
+            sprite_release(sprite_find(upload.handle));
+            return -EFAULT; 
+        }
+        break;
+    }
+    case SPITFT_IOCDRAWSPRITE: {
+        if (copy_from_user((void *)&draw, (const void __user *)arg, sizeof(SpriteDraw)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_from_user\n");
+            return -EFAULT; 
+        }
+        return sprite_draw(&draw);
+    }
+    case SPITFT_IOCFREESPRITE: {
+        if (copy_from_user((void *)&handle, (const void __user *)arg, sizeof(int32_t)) != 0) {
+            printk(KERN_ERR "[EFAULT] in tft_ioctl::__copy_from_user\n");
+            return -EFAULT; 
+        }
+        else if ((sprite = sprite_find(handle)) == NULL) {
+            return -ENOENT;
+        }
+        sprite_release(sprite);
+        break;
+    }
+    default:
+        printk(KERN_ERR "[ENOTTY] in tft_ioctl\n");
+        return -ENOTTY;
+    }
 
-    PDEBUG("set write_mode: %u in tft_ioctl\n", write_mode);
 	return 0;
 }
 
+long tft_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    long ret;
+    if (cmd == SPITFT_IOCPRESENT || cmd == SPITFT_IOCPRESENTFB)
+        return present_ioctl(filp, cmd, arg);
+
+    if (mutex_lock_interruptible(&tft_mutex))
+        return -ERESTARTSYS;
+
+    ret = tft_ioctl_locked(filp, cmd, arg);
+    mutex_unlock(&tft_mutex);
+    return ret;
+}
+
 static const struct of_device_id of_tft_match[] = {
-    { .compatible = "ilitek,spitft" },
+    { .compatible = "ilitek,spitft", .data = &ili9341_panel },
+    { .compatible = "ilitek,ili9341", .data = &ili9341_panel },
+    { .compatible = "sitronix,st7789v", .data = &st7789_panel },
+    { .compatible = "ilitek,ili9488", .data = &ili9488_panel },
     { /* sentinel */ },
 };
 MODULE_DEVICE_TABLE(of, of_tft_match);
@@ -254,6 +1419,8 @@ static struct file_operations tft_fops = {
     .owner =    THIS_MODULE,
     .read =     tft_read,
     .write =    tft_write,
+    .write_iter = tft_write_iter,
+    .splice_write = iter_file_splice_write,
     .open =     tft_open,
     .release =  tft_release,
     .unlocked_ioctl = tft_ioctl,
@@ -290,20 +1457,57 @@ static int __init tft_init_module(void) {
     printk(KERN_NOTICE "tftchar registered at %x (%i, %i)\n", devno, MAJOR(devno), MINOR(devno));
     if( (err = spi_register_driver(&spi_tft_driver)) < 0 ) {
         printk(KERN_ERR "[errno %i] in tft_init_module::spi_register_driver\n", -err);
-        return err;
+        goto fail_cdev;
     }
     
     init_tft_display(&tft_spidev);
-    if ((frame_buffer = (uint8_t *)kmalloc(ILI9341_TFTWIDTH*ILI9341_TFTHEIGHT*2, GFP_KERNEL)) == NULL) {
+    if ((frame_buffer = (uint8_t *)kmalloc(TFT_NPIXELS*2, GFP_KERNEL)) == NULL ||
+        (row_buffer = (uint8_t *)kmalloc(TFT_NPIXELS*2, GFP_KERNEL)) == NULL) {
         printk(KERN_ERR "[ENOMEM] in tft_init_module::kmalloc\n");
-        return -ENOMEM;
+        err = -ENOMEM;
+        goto fail_buffers;
+    }
+
+    if (frame_diff && (err = diff_enable(true)) != 0)
+        goto fail_buffers;
+
+    // Present queue flushes run on a high priority ordered workqueue to limit wakeup jitter
+    hrtimer_init(&present_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    present_timer.function = present_timer_fn;
+    INIT_WORK(&present_work, present_work_fn);
+    if ((present_wq = alloc_ordered_workqueue("tftpresent", WQ_HIGHPRI)) == NULL) {
+        printk(KERN_ERR "[ENOMEM] in tft_init_module::alloc_ordered_workqueue\n");
+        err = -ENOMEM;
+        goto fail_buffers;
     }
+
+#ifdef SPI_TFT_V4L2
+    // Optional: the cdev keeps working if the V4L2 output fails to register
+    if (tft_spidev.ili9341) video_register(&tft_spidev.ili9341->dev);
+#endif
     return 0;
+
+    // Unwind in reverse, nothing may outlive a failed load (an open() would run unloaded code)
+fail_buffers:
+    diff_free();
+    kfree(row_buffer);
+    kfree(frame_buffer);
+    kfree(tft_spidev.xfer_buf);
+    row_buffer = frame_buffer = tft_spidev.xfer_buf = NULL;
+    spi_unregister_driver(&spi_tft_driver);
+fail_cdev:
+    cdev_del(&tft_cdev);
+    unregister_chrdev_region(devno, 1);
+    return err;
 }
 
 static void __exit tft_cleanup_module(void) {
     dev_t devno;
 
+#ifdef SPI_TFT_V4L2
+    video_unregister();
+#endif
+    present_free();
     send_command(&tft_spidev, ILI9341_DISPOFF); mdelay(150); // Display off
     send_command(&tft_spidev, ILI9341_SLPIN); mdelay(150); // Enter Sleep
 
@@ -312,6 +1516,12 @@ static void __exit tft_cleanup_module(void) {
     unregister_chrdev_region(devno, 1);
     spi_unregister_driver(&spi_tft_driver);
     kfree(frame_buffer);
+    kfree(row_buffer);
+    diff_free();
+    kfree(tft_spidev.xfer_buf);
+
+    for (int i=0; i<SPRITE_NSLOTS; ++i)
+        if (sprite_cache[i].handle != 0) sprite_release(&sprite_cache[i]);
 }
 
 module_init(tft_init_module);